@@ -4,7 +4,10 @@
  * There are 5 comma-delimited values for each routine:
  * 1. The routine (possible values are in enum sb_routine_e in src/statusbar.h)
  * 2. How often in seconds to run each routine. For example, a value 5 means to
- *    run every 5 seconds.
+ *    run every 5 seconds. TODO, VOLUME, and WIFI can be set to 0 to only update
+ *    when something changes. WIFI also updates right away when the connection
+ *    changes, but the kernel doesn't announce changes in signal strength, so
+ *    the interval is what keeps the signal current.
  * 3. The color in RGB form to use for normal operating conditions.
  * 4. The color in RGB form to use for warning operating conditions.
  * 5. The color in RGB form to use for error operating conditions.
@@ -25,7 +28,7 @@ static const struct {
 	const char        *color_error;
 } chosen_routines[] = {
 	/* TOP BAR */       /* normal     warning    error */
-	{ TODO     , 5      , "#FFFFFF", "#BB4F2E", "#A1273E" },
+	{ TODO     , 0      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ WEATHER  , 60 * 30, "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ WIFI     , 5      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ TIME     , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
@@ -36,13 +39,15 @@ static const struct {
 	/*BOTTOM BAR */
 	{ NETWORK  , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ DISK     , 5      , "#FFFFFF", "#BB4F2E", "#A1273E" },
+	{ DISKIO   , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ RAM      , 5      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ LOAD     , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
+	{ PRESSURE , 2      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ CPU_USAGE, 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ CPU_TEMP , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 	{ FAN      , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
-	{ BATTERY  , 30     , "#FFFFFF", "#BB4F2E", "#A1273E" },
-	{ VOLUME   , 1      , "#FFFFFF", "#BB4F2E", "#A1273E" },
+	{ BATTERY  , 60     , "#FFFFFF", "#BB4F2E", "#A1273E" },
+	{ VOLUME   , 0      , "#FFFFFF", "#BB4F2E", "#A1273E" },
 };
 
 /* With the status2d patch, you can color the output of each
@@ -51,7 +56,45 @@ static const struct {
  * SB_FALSE = default color based on dwm settings */
 static SB_BOOL color_text = SB_TRUE;
 
-/* The mounted filesystems to display for the DISK routine.
+/* The text around each routine's output, and between the two bars (see DELIMITER above). */
+static const char *routine_prefix = "[";
+static const char *routine_suffix = "] ";
+static const char *bar_delimiter  = ";";
+
+/* How the routines are scheduled.
+ * SB_ENGINE_THREADS    = each routine runs in its own thread
+ * SB_ENGINE_EVENT_LOOP = all routines run from the print loop in a single thread,
+ *                        woken by one timer for each distinct interval */
+static enum sb_engine_e engine = SB_ENGINE_THREADS;
+
+/* How each routine's thread waits for its next run.
+ * SB_SCHEDULE_RELATIVE = sleep for the interval minus however long the update took
+ * SB_SCHEDULE_ABSOLUTE = sleep until the next deadline, with all deadlines aligned to
+ *                        program start so routines stay in phase with the print loop
+ * The event loop engine is always aligned this way. */
+static enum sb_schedule_e schedule = SB_SCHEDULE_ABSOLUTE;
+
+/* What to do when a routine takes longer than its interval.
+ * SB_OVERRUN_SKIP    = skip the missed runs and wait for the next deadline
+ * SB_OVERRUN_CATCHUP = make up every missed run immediately */
+static enum sb_overrun_e overrun = SB_OVERRUN_SKIP;
+
+/* How long after the routines' deadlines to print the status bar, in microseconds.
+ * This gives routines that run every second time to finish before their output is printed. */
+static long print_delay = 50000;
+
+/* With the event loop engine, run routines whose intervals are multiples of each other
+ * from a single wakeup, one after the other, and print the status bar right after them.
+ * Because routine intervals are whole seconds, this means one wakeup per second. */
+static SB_BOOL coalesce = SB_TRUE;
+
+/* Print the status bar as soon as a routine has new output, instead of waiting for the next
+ * print every second. To keep quickly changing routines from redrawing the bar too often,
+ * prints are kept at least min_print_interval microseconds apart. */
+static SB_BOOL print_on_change    = SB_TRUE;
+static long    min_print_interval = 100000;
+
+/* The mounted filesystems to display for the DISK and DISKIO routines.
  * The first value is the absolute path to the partition's mount point.
  * The second value is the display name to use for it. */
 static const struct {
@@ -62,6 +105,35 @@ static const struct {
 	{ "/home", "home" },
 };
 
+/* For the CPU_USAGE routine, also show the busiest core and its usage. */
+static SB_BOOL cpu_show_hottest = SB_TRUE;
+
+/* For the CPU_USAGE routine, the parts of the CPU time to show after the total usage, as a
+ * share of all CPU time. Combine values from enum sb_cpu_time_e in src/statusbar.h with |,
+ * for example SB_CPU_IOWAIT | SB_CPU_STEAL. 0 shows only the total. */
+static int cpu_breakdown = 0;
+
+/* For the RAM routine, the figures to show after the free and total memory. Combine values
+ * from enum sb_ram_detail_e in src/statusbar.h with |. 0 shows only free and total memory. */
+static int ram_details = SB_RAM_SWAP;
+
+/* For the PRESSURE routine, which of the kernel's two stall figures to show for each resource.
+ * SB_FALSE = share of time that at least one task was stalled ("some")
+ * SB_TRUE  = share of time that every task was stalled at once ("full")
+ * The routine turns the warning color when any resource's 10-second average reaches
+ * pressure_warning percent, and the error color at pressure_error percent. */
+static SB_BOOL pressure_full    = SB_FALSE;
+static double  pressure_warning = 10.0;
+static double  pressure_error   = 25.0;
+
+/* For the PRESSURE routine, how many microseconds of stalls within each window of
+ * pressure_trigger_window microseconds make the kernel wake the routine right away, instead of
+ * waiting for the next interval. The window must be between 0.5 and 10 seconds, and a whole
+ * number of seconds divisible by 2 if the program is not run as root. Set the stall to 0 to only
+ * check every interval. */
+static long pressure_trigger_stall  = 500000;
+static long pressure_trigger_window = 2000000;
+
 /* The conversion specification for the TIME routine.
  * See strftime(3) for more options. */
 static const char *time_format = "%b %d - %I:%M";
@@ -74,3 +146,9 @@ static const char *todo_path = ".TODO";
 /* For the WEATHER routine, the zip code to use for
  * getting weather data. */
 static const char *zip_code = "90210";
+
+/* For the WEATHER routine, how long in seconds to keep using the forecast URL that was looked
+ * up for zip_code. The URL is cached in $XDG_CACHE_HOME/statusbar/weather (or
+ * ~/.cache/statusbar/weather), so that restarting the program doesn't have to look it up
+ * again. Set to 0 to look it up on every start. */
+static time_t weather_cache_ttl = 60 * 60 * 24 * 7;
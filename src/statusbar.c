@@ -9,13 +9,8 @@
 #define SB_STOP_TIMER \
 		clock_gettime(CLOCK_MONOTONIC_RAW, &finish_tp);
 
-#define SB_SLEEP \
-		elapsed_usec = ((finish_tp.tv_sec - start_tp.tv_sec) * 1000000) + ((finish_tp.tv_nsec - start_tp.tv_nsec) / 1000); \
-		if (elapsed_usec < routine->interval) { \
-			if (usleep(routine->interval - elapsed_usec) != 0) { \
-				sb_print_error(routine, "Error sleeping"); \
-			} \
-		}
+#define SB_ELAPSED \
+		elapsed_usec = ((finish_tp.tv_sec - start_tp.tv_sec) * 1000000) + ((finish_tp.tv_nsec - start_tp.tv_nsec) / 1000);
 
 #define SB_TIMER_VARS \
 	struct timespec start_tp  = {0}; \
@@ -40,6 +35,26 @@ static float sb_calc_magnitude(long number, char *unit)
 	return (number / powl(10, 3*(i-1))) / 1000.0;
 }
 
+static void sb_timespec_add(struct timespec *tp, long usec)
+{
+	/* Advance tp by usec microseconds, or move it back if usec is negative. */
+	tp->tv_sec  += usec / 1000000;
+	tp->tv_nsec += (usec % 1000000) * 1000;
+	if (tp->tv_nsec >= 1000000000) {
+		tp->tv_sec  += 1;
+		tp->tv_nsec -= 1000000000;
+	} else if (tp->tv_nsec < 0) {
+		tp->tv_sec  -= 1;
+		tp->tv_nsec += 1000000000;
+	}
+}
+
+static long sb_timespec_diff(const struct timespec *start, const struct timespec *finish)
+{
+	/* Return the time from start to finish in microseconds. */
+	return ((finish->tv_sec - start->tv_sec) * 1000000) + ((finish->tv_nsec - start->tv_nsec) / 1000);
+}
+
 static void sb_debug(const char *name, const char *message, ...)
 {
 #ifdef DEBUG
@@ -117,12 +132,50 @@ static long sb_normalize_perc(long num)
 	return num;
 }
 
-static void *sb_null_cb(void *thunk)
+static void sb_publish(sb_routine_t *routine, const char *color, const char *format, ...)
 {
-	/* empty function to satisfy TIME not having a proper thread */
-	(void)thunk;
+	/* This will set the routine's output and color together. The routine's generation only
+	 * advances if either of them actually changed, which lets the print loop skip printing
+	 * when nothing is new.
+	 * Only the routine itself writes its output, so it can compare against the current
+	 * values without any locking. The sequence lock only has to keep readers from seeing a
+	 * half-written output. */
+	va_list      args;
+	char         output[sizeof(routine->output)];
+	int          len;
+	size_t       length;
+	unsigned int seq;
+	uint64_t     one = 1;
 
-	return NULL;
+	va_start(args, format);
+	len = vsnprintf(output, sizeof(output), format, args);
+	va_end(args);
+
+	if (len < 0)
+		len = 0;
+	length = (size_t)len < sizeof(output) ? (size_t)len : sizeof(output) - 1;
+	output[length] = '\0';
+
+	if (routine->color == color && routine->length == length &&
+	    memcmp(routine->output, output, length) == 0)
+		return;
+
+	seq = atomic_load_explicit(&(routine->seq), memory_order_relaxed);
+	atomic_store_explicit(&(routine->seq), seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	routine->color  = color;
+	routine->length = length;
+	memcpy(routine->output, output, length + 1);
+	atomic_fetch_add_explicit(&(routine->generation), 1, memory_order_relaxed);
+
+	atomic_store_explicit(&(routine->seq), seq + 2, memory_order_release);
+
+	/* Let the print loop know there is something new to print. */
+	if (notify_fd >= 0) {
+		if (write(notify_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+			fprintf(stderr, "%s: Failed to notify print loop\n", routine->name);
+	}
 }
 
 static void sb_print_error(sb_routine_t *routine, const char *format, ...)
@@ -133,10 +186,7 @@ static void sb_print_error(sb_routine_t *routine, const char *format, ...)
 	if (routine == NULL)
 		return;
 
-	routine->color = routine->colors.error;
-	pthread_mutex_lock(&(routine->mutex));
-	snprintf(routine->output, sizeof(routine->output), "%s: Error", routine->name);
-	pthread_mutex_unlock(&(routine->mutex));
+	sb_publish(routine, routine->colors.error, "%s: Error", routine->name);
 
 	va_start(args, format);
 
@@ -177,6 +227,142 @@ static SB_BOOL sb_read_file(char buf[], size_t size, const char *base, const cha
 	return SB_TRUE;
 }
 
+static SB_BOOL sb_file_open(sb_file_t *file, const char *base, const char *name, sb_routine_t *routine)
+{
+	/* This will open the file at base and name (or just base if no name is passed in) and keep
+	 * it open, so that it can be read every interval without looking up the path again. */
+	snprintf(file->path, sizeof(file->path), "%s%s", base, name?name:"");
+
+	file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0) {
+		sb_print_error(routine, "Failed to open %s", file->path);
+		return SB_FALSE;
+	}
+
+	/* Let the event loop know about the file so it can read it before the routine runs. */
+	if (routine->num_files < SB_MAX_FILES)
+		routine->files[routine->num_files++] = file;
+
+	sb_debug(__func__, "opened %s", file->path);
+	return SB_TRUE;
+}
+
+static void sb_file_close(sb_file_t *file)
+{
+	if (file->fd >= 0)
+		close(file->fd);
+	file->fd = -1;
+}
+
+static SB_BOOL sb_file_read(sb_file_t *file, char buf[], size_t size, sb_routine_t *routine)
+{
+	/* This will read the file from the beginning into buf. For sysfs and procfs files, reading
+	 * from offset 0 again gets a fresh value. If the read fails, the file is reopened once in
+	 * case it went away and came back (for example, a device that was unplugged). */
+	ssize_t len = -1;
+	int     i;
+
+#ifdef BUILD_IO_URING
+	/* Use the sample from the batched read if there is one, unless it filled the sample
+	 * buffer and the caller has room for more. */
+	if (file->ready && (file->len < (ssize_t)sizeof(file->data) || size <= sizeof(file->data))) {
+		len = file->len < (ssize_t)size - 1 ? file->len : (ssize_t)size - 1;
+		memcpy(buf, file->data, len);
+	}
+	file->ready = SB_FALSE;
+#endif
+
+	for (i=0; i<2 && len < 0; i++) {
+		if (file->fd < 0)
+			file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+		if (file->fd < 0)
+			continue;
+
+		len = pread(file->fd, buf, size-1, 0);
+		if (len < 0)
+			sb_file_close(file);
+	}
+
+	if (len < 0) {
+		sb_print_error(routine, "Failed to read %s", file->path);
+		return SB_FALSE;
+	}
+
+	buf[len] = '\0';
+	return SB_TRUE;
+}
+
+/* epoll instance of the event loop, or -1 if routines are only run from threads. */
+static int sb_loop_fd = -1;
+
+static SB_BOOL sb_watch_add(sb_routine_t *routine, int fd, short events)
+{
+	/* This will have the routine's event callback run whenever fd is ready for events. For
+	 * routines run from the event loop, fd is added to the loop's epoll instance (poll and
+	 * epoll events have the same values). Threaded routines poll their fds while they wait
+	 * for the next update. */
+	struct epoll_event event;
+	sb_watch_t        *watch = NULL;
+	int                i;
+
+	for (i=0; i<SB_MAX_WATCHES && watch == NULL; i++) {
+		if (routine->watches[i].events == 0)
+			watch = &(routine->watches[i]);
+	}
+	if (watch == NULL) {
+		sb_print_error(routine, "Too many file descriptors to watch");
+		return SB_FALSE;
+	}
+
+	watch->source  = SB_SOURCE_WATCH;
+	watch->fd      = fd;
+	watch->events  = events;
+	watch->routine = routine;
+
+	if (!routine->threaded && sb_loop_fd >= 0) {
+		memset(&event, 0, sizeof(event));
+		event.events   = events;
+		event.data.ptr = watch;
+		if (epoll_ctl(sb_loop_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			sb_print_error(routine, "Failed to watch file descriptor");
+			watch->events = 0;
+			return SB_FALSE;
+		}
+	}
+
+	sb_debug(routine->name, "watching fd %d", fd);
+	return SB_TRUE;
+}
+
+static void sb_watch_remove(sb_routine_t *routine, int fd)
+{
+	/* This will stop watching fd. It must be called before fd is closed. */
+	int i;
+
+	for (i=0; i<SB_MAX_WATCHES; i++) {
+		if (routine->watches[i].events == 0 || routine->watches[i].fd != fd)
+			continue;
+
+		if (!routine->threaded && sb_loop_fd >= 0)
+			epoll_ctl(sb_loop_fd, EPOLL_CTL_DEL, fd, NULL);
+		routine->watches[i].events = 0;
+		sb_debug(routine->name, "stopped watching fd %d", fd);
+	}
+}
+
+static sb_watch_t *sb_watch_find(sb_routine_t *routine, int fd)
+{
+	/* Get the routine's current watch on fd, or NULL if fd isn't being watched. */
+	int i;
+
+	for (i=0; i<SB_MAX_WATCHES; i++) {
+		if (routine->watches[i].events != 0 && routine->watches[i].fd == fd)
+			return &(routine->watches[i]);
+	}
+
+	return NULL;
+}
+
 static SB_BOOL sb_get_path(char buf[], size_t size, const char *base, const char *file, const char *match, sb_routine_t *routine)
 {
 	/* This will open the directory at base and search through every subdirectory until a file with
@@ -217,76 +403,174 @@ static SB_BOOL sb_get_path(char buf[], size_t size, const char *base, const char
 
 
 /* --- BATTERY ROUTINE --- */
-static void *sb_battery_routine(void *thunk)
-{
-	sb_routine_t *routine = thunk;
+#ifdef BUILD_BATTERY
+static struct {
+	char      path[512];
+	long      max;
+	sb_file_t now;
+	sb_file_t status;
+	int       uevent; /* Netlink socket for kernel uevents. */
+} sb_battery;
+#endif
 
+static SB_BOOL sb_battery_init(sb_routine_t *routine)
+{
 #ifdef BUILD_BATTERY
-	SB_TIMER_VARS;
 	static const char *base = "/sys/class/power_supply";
 	static const char *file = "type";
-	char               path[512];
 	char               buf[512];
-	long               max;
-	long               now;
-	long               perc;
 
-	if (!sb_get_path(path, sizeof(path), base, file, "Battery", routine)) {
-		routine->run = SB_FALSE;
-	} else if (!sb_read_file(buf, sizeof(buf), path, "charge_full", routine)) {
-		routine->run = SB_FALSE;
+	struct sockaddr_nl addr;
+
+	sb_battery.now.fd    = -1;
+	sb_battery.status.fd = -1;
+	sb_battery.uevent    = -1;
+	if (!sb_get_path(sb_battery.path, sizeof(sb_battery.path), base, file, "Battery", routine))
+		return SB_FALSE;
+
+	if (!sb_read_file(buf, sizeof(buf), sb_battery.path, "charge_full", routine))
+		return SB_FALSE;
+
+	sb_battery.max = atol(buf);
+	if (sb_battery.max <= 0) {
+		sb_print_error(routine, "Failed to read max level");
+		return SB_FALSE;
+	}
+
+	if (!sb_file_open(&sb_battery.now, sb_battery.path, "charge_now", routine))
+		return SB_FALSE;
+	if (!sb_file_open(&sb_battery.status, sb_battery.path, "status", routine))
+		return SB_FALSE;
+	sb_debug(__func__, "init: found %s", sb_battery.path);
+
+	/* Listen for the kernel's power_supply uevents so that plugging in or unplugging the
+	 * charger shows up right away. The charge level itself changes slowly enough that it is
+	 * only read every interval. */
+	sb_battery.uevent = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if (sb_battery.uevent < 0) {
+		sb_print_error(routine, "Failed to open uevent socket");
+		return SB_FALSE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; /* kernel uevents */
+	if (bind(sb_battery.uevent, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		sb_print_error(routine, "Failed to listen for uevents");
+		return SB_FALSE;
+	}
+
+	return sb_watch_add(routine, sb_battery.uevent, POLLIN);
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_battery_update(sb_routine_t *routine)
+{
+#ifdef BUILD_BATTERY
+	char        buf[512];
+	long        now;
+	long        perc;
+	SB_BOOL     charging;
+	const char *color;
+
+	if (!sb_file_read(&sb_battery.status, buf, sizeof(buf), routine))
+		return SB_FALSE;
+	charging = strncmp(buf, "Charging", 8) == 0 ? SB_TRUE : SB_FALSE;
+
+	if (!sb_file_read(&sb_battery.now, buf, sizeof(buf), routine))
+		return SB_FALSE;
+
+	now = atol(buf);
+	if (now < 0) {
+		sb_print_error(routine, "Failed to read current level");
+		return SB_FALSE;
+	}
+
+	perc = sb_normalize_perc((now*100)/sb_battery.max);
+	if (perc > 25 || charging) {
+		color = routine->colors.normal;
+	} else if (perc > 10) {
+		color = routine->colors.warning;
 	} else {
-		max = atol(buf);
-		if (max <= 0) {
-			sb_print_error(routine, "Failed to read max level");
-			routine->run = SB_FALSE;
-		}
+		color = routine->colors.error;
 	}
-	if (routine->run)
-		sb_debug(__func__, "init: found %s", path);
-	sb_leak_check(__func__);
 
-	while (routine->run) {
-		SB_START_TIMER;
+	sb_publish(routine, color, "%ld%% %s", perc, charging ? "CHG" : "BAT");
 
-		if (!sb_read_file(buf, sizeof(buf), path, "charge_now", routine))
-			break;
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
 
-		now = atol(buf);
-		if (now < 0) {
-			sb_print_error(routine, "Failed to read current level");
-			break;
-		}
+static SB_BOOL sb_battery_event(sb_routine_t *routine, int fd, short revents)
+{
+	/* Each uevent is a header ("change@/devices/...") followed by NUL-separated KEY=value
+	 * pairs. Read the battery again if any of the uevents are for a power supply. */
+#ifdef BUILD_BATTERY
+	char     buf[4096];
+	ssize_t  len;
+	char    *ptr;
+	SB_BOOL  changed = SB_FALSE;
+
+	(void)revents;
+	while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0 || (len < 0 && errno == EINTR)) {
+		if (len <= 0)
+			continue;
 
-		perc = sb_normalize_perc((now*100)/max);
-		if (perc > 25) {
-			routine->color = routine->colors.normal;
-		} else if (perc > 10) {
-			routine->color = routine->colors.warning;
-		} else {
-			routine->color = routine->colors.error;
+		buf[len] = '\0';
+		for (ptr = buf; ptr < buf + len; ptr += strlen(ptr) + 1) {
+			if (strcmp(ptr, "SUBSYSTEM=power_supply") == 0) {
+				changed = SB_TRUE;
+				break;
+			}
 		}
+	}
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%ld%% BAT", perc);
-		pthread_mutex_unlock(&(routine->mutex));
-
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+	if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+		sb_print_error(routine, "Failed to receive uevents");
+		return SB_FALSE;
 	}
+
+	/* If uevents were dropped, one of them might have been ours. */
+	if (!changed && !(len < 0 && errno == ENOBUFS))
+		return SB_TRUE;
+
+	sb_debug(__func__, "power supply changed");
+	return sb_battery_update(routine);
 #else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	(void)routine;
+	(void)fd;
+	(void)revents;
+	return SB_FALSE;
 #endif
+}
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+static void sb_battery_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_BATTERY
+	sb_file_close(&sb_battery.now);
+	sb_file_close(&sb_battery.status);
+	if (sb_battery.uevent >= 0)
+		close(sb_battery.uevent);
+	sb_battery.uevent = -1;
+#endif
+	(void)routine;
 }
 
 
 /* --- CPU TEMP ROUTINE --- */
 #ifdef BUILD_CPU_TEMP
+static struct {
+	char      path[512];
+	char      filename[128];
+	sb_file_t input;
+} sb_cpu_temp;
+
 static SB_BOOL sb_cpu_temp_get_filename(char path[], char filename[], size_t size, sb_routine_t *routine)
 {
 	/* This will open the directory at path and look at every file until it finds one named
@@ -321,231 +605,701 @@ static SB_BOOL sb_cpu_temp_get_filename(char path[], char filename[], size_t siz
 }
 #endif
 
-static void *sb_cpu_temp_routine(void *thunk)
+static SB_BOOL sb_cpu_temp_init(sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
-
 #ifdef BUILD_CPU_TEMP
-	SB_TIMER_VARS;
-	char path[512];
-	char filename[128];
-	char contents[128];
-	long now;
-
-	if (!sb_get_path(path, sizeof(path), "/sys/class/hwmon", "name", "coretemp", routine)) {
-		routine->run = SB_FALSE;
-	} else if (!sb_cpu_temp_get_filename(path, filename, sizeof(filename), routine)) {
-		routine->run = SB_FALSE;
-	} else {
-		sb_debug(__func__, "init: found %s%s", path, filename);
-	}
-	sb_leak_check(__func__);
-
-	while (routine->run) {
-		SB_START_TIMER;
-
-		if (!sb_read_file(contents, sizeof(contents), path, filename, routine))
-			break;
-
-		now = atol(contents);
-		if (now < 0) {
-			sb_print_error(routine, "Failed to read temperature");
-			break;
-		}
+	sb_cpu_temp.input.fd = -1;
+	if (!sb_get_path(sb_cpu_temp.path, sizeof(sb_cpu_temp.path), "/sys/class/hwmon", "name", "coretemp", routine))
+		return SB_FALSE;
 
-		now /= 1000; /* convert to celsius */
-		if (now < 75) {
-			routine->color = routine->colors.normal;
-		} else if (now < 100) {
-			routine->color = routine->colors.warning;
-		} else {
-			routine->color = routine->colors.error;
-		}
+	if (!sb_cpu_temp_get_filename(sb_cpu_temp.path, sb_cpu_temp.filename, sizeof(sb_cpu_temp.filename), routine))
+		return SB_FALSE;
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%ld °C", now);
-		pthread_mutex_unlock(&(routine->mutex));
+	if (!sb_file_open(&sb_cpu_temp.input, sb_cpu_temp.path, sb_cpu_temp.filename, routine))
+		return SB_FALSE;
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
-	}
+	sb_debug(__func__, "init: found %s%s", sb_cpu_temp.path, sb_cpu_temp.filename);
+	return SB_TRUE;
 #else
 	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
 #endif
-
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
 }
 
-
-/* --- CPU USAGE ROUTINE --- */
-#ifdef BUILD_CPU_USAGE
-static SB_BOOL sb_cpu_usage_get_ratio(int *ratio)
+static SB_BOOL sb_cpu_temp_update(sb_routine_t *routine)
 {
-	/* Calculate the thread-to-processor ratio. */
-	int procs;  /* number of processors */
-	int online; /* number online */
+#ifdef BUILD_CPU_TEMP
+	char        contents[128];
+	long        now;
+	const char *color;
 
-	procs  = get_nprocs_conf();
-	online = get_nprocs();
+	if (!sb_file_read(&sb_cpu_temp.input, contents, sizeof(contents), routine))
+		return SB_FALSE;
 
-	if (procs < 1 || online < 1)
+	now = atol(contents);
+	if (now < 0) {
+		sb_print_error(routine, "Failed to read temperature");
 		return SB_FALSE;
+	}
+
+	now /= 1000; /* convert to celsius */
+	if (now < 75) {
+		color = routine->colors.normal;
+	} else if (now < 100) {
+		color = routine->colors.warning;
+	} else {
+		color = routine->colors.error;
+	}
 
-	*ratio = online / procs;
+	sb_publish(routine, color, "%ld °C", now);
 
 	return SB_TRUE;
-}
+#else
+	(void)routine;
+	return SB_FALSE;
 #endif
+}
 
-static void *sb_cpu_usage_routine(void *thunk)
+static void sb_cpu_temp_cleanup(sb_routine_t *routine)
 {
-	sb_routine_t      *routine = thunk;
+#ifdef BUILD_CPU_TEMP
+	sb_file_close(&sb_cpu_temp.input);
+#endif
+	(void)routine;
+}
+
 
+/* --- CPU USAGE ROUTINE --- */
 #ifdef BUILD_CPU_USAGE
-	SB_TIMER_VARS;
-	int                ratio;
-	static const char *path = "/proc/stat";
-	char               contents[128];
-	unsigned long      used;
-	unsigned long      total;
-	long               perc;
-	struct {
-		unsigned long user;
-		unsigned long nice;
-		unsigned long system;
-		unsigned long idle;
-	} old, new;
-
-	sb_debug(__func__, "init: get thread-to-processor ratio");
-	if (!sb_cpu_usage_get_ratio(&ratio)) {
-		sb_print_error(routine, "Failed to determine ratio");
-		routine->run = SB_FALSE;
+/* Fields of a CPU line in /proc/stat, in order. guest and guest_nice are already counted in
+ * user and nice. */
+enum sb_cpu_field_e {
+	SB_CPU_FIELD_USER = 0,
+	SB_CPU_FIELD_NICE,
+	SB_CPU_FIELD_SYSTEM,
+	SB_CPU_FIELD_IDLE,
+	SB_CPU_FIELD_IOWAIT,
+	SB_CPU_FIELD_IRQ,
+	SB_CPU_FIELD_SOFTIRQ,
+	SB_CPU_FIELD_STEAL,
+	SB_CPU_FIELD_GUEST,
+	SB_CPU_FIELD_GUEST_NICE,
+	SB_CPU_FIELDS,
+};
+
+/* Parts of the CPU time that can be shown on their own, in the same order as enum sb_cpu_time_e. */
+static const struct {
+	const char *label;
+	int         fields[2]; /* Fields that add up to this time. -1 if unused. */
+} sb_cpu_times[] = {
+	{ "user" , { SB_CPU_FIELD_USER  , SB_CPU_FIELD_NICE    } },
+	{ "sys"  , { SB_CPU_FIELD_SYSTEM, -1                   } },
+	{ "io"   , { SB_CPU_FIELD_IOWAIT, -1                   } },
+	{ "steal", { SB_CPU_FIELD_STEAL , -1                   } },
+	{ "irq"  , { SB_CPU_FIELD_IRQ   , SB_CPU_FIELD_SOFTIRQ } },
+};
+
+static struct {
+	sb_file_t      stat;
+	char          *buf;       /* Buffer that /proc/stat is read into, reused every update. */
+	size_t         size;      /* Size of buf. It grows if the CPU lines don't fit. */
+	int            num_cpus;  /* Number of cores. */
+	/* For the following arrays, [0] is for all cores together and [i+1] is for core i. */
+	unsigned long *busy;      /* Time spent busy, as of the current update. */
+	unsigned long *total;     /* Total time, as of the current update. */
+	unsigned long *old_busy;  /* Time spent busy, as of the last update. */
+	unsigned long *old_total; /* Total time, as of the last update. */
+	long          *perc;      /* Usage over the last interval. */
+	unsigned long  fields[SB_CPU_FIELDS];     /* Every field for all cores together. */
+	unsigned long  old_fields[SB_CPU_FIELDS];
+} sb_cpu_usage;
+
+static const char *sb_cpu_usage_parse_ulong(const char *ptr, unsigned long *value)
+{
+	/* Skip the spaces before the number, then add up its digits. With a few hundred numbers
+	 * on a machine with many cores, this is much faster than sscanf. */
+	unsigned long num = 0;
+
+	while (*ptr == ' ')
+		ptr++;
+	while ((unsigned char)(*ptr - '0') < 10) {
+		num = (num * 10) + (unsigned long)(*ptr - '0');
+		ptr++;
 	}
-	sb_debug(__func__, "init: thread-to-processor ratio: %d", ratio);
-	sb_leak_check(__func__);
 
-	memset(&old, 0, sizeof(old));
-	memset(&new, 0, sizeof(new));
-	while (routine->run) {
-		SB_START_TIMER;
+	*value = num;
+	return ptr;
+}
 
-		if (!sb_read_file(contents, sizeof(contents), path, NULL, routine))
-			break;
-		if (sscanf(contents, "cpu %lu %lu %lu %lu", &new.user, &new.nice, &new.system, &new.idle) != 4 ) {
-			sb_print_error(routine, "Failed to read %s", path);
-			break;
-		}
+static SB_BOOL sb_cpu_usage_parse(void)
+{
+	/* This will read the times out of every CPU line ("cpu" for all cores together, then
+	 * "cpu0", "cpu1", ...) at the top of /proc/stat. Cores that are offline have no line, so
+	 * their times are left alone. Returns SB_FALSE if the buffer ran out before the end of
+	 * the CPU lines. */
+	const char    *ptr = sb_cpu_usage.buf;
+	unsigned long  index;
+	unsigned long  fields[SB_CPU_FIELDS];
+	unsigned long  idle;
+	unsigned long  total;
+	int            i;
 
-		used  = (new.user-old.user) + (new.nice-old.nice) + (new.system-old.system);
-		total = (new.user-old.user) + (new.nice-old.nice) + (new.system-old.system) + (new.idle-old.idle);
-		perc  = ((used * 100) / total) / ratio;
-		perc  = sb_normalize_perc(perc);
-		if (perc < 75) {
-			routine->color = routine->colors.normal;
-		} else if (perc < 90) {
-			routine->color = routine->colors.warning;
+	while (ptr[0] == 'c' && ptr[1] == 'p' && ptr[2] == 'u') {
+		ptr += 3;
+		if (*ptr == ' ') {
+			index = 0;
 		} else {
-			routine->color = routine->colors.error;
+			ptr = sb_cpu_usage_parse_ulong(ptr, &index);
+			index++;
 		}
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%2lu%% CPU", perc);
-		pthread_mutex_unlock(&(routine->mutex));
+		/* Older kernels have fewer fields. The missing ones come out as 0. */
+		for (i=0; i<SB_CPU_FIELDS; i++)
+			ptr = sb_cpu_usage_parse_ulong(ptr, &fields[i]);
+
+		/* Time spent waiting on I/O is idle time as far as the CPU is concerned. Guest time
+		 * is left out of the total because it is already part of user and nice. */
+		idle  = fields[SB_CPU_FIELD_IDLE] + fields[SB_CPU_FIELD_IOWAIT];
+		total = idle;
+		for (i=0; i<SB_CPU_FIELD_GUEST; i++) {
+			if (i != SB_CPU_FIELD_IDLE && i != SB_CPU_FIELD_IOWAIT)
+				total += fields[i];
+		}
 
-		old.user   = new.user;
-		old.nice   = new.nice;
-		old.system = new.system;
-		old.idle   = new.idle;
+		if (index == 0)
+			memcpy(sb_cpu_usage.fields, fields, sizeof(fields));
+		if (index <= (unsigned long)sb_cpu_usage.num_cpus) {
+			sb_cpu_usage.busy[index]  = total - idle;
+			sb_cpu_usage.total[index] = total;
+		}
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+		/* The CPU lines are always followed by other lines, so hitting the end of the buffer
+		 * means that it was too small. */
+		ptr = strchr(ptr, '\n');
+		if (ptr == NULL || *(++ptr) == '\0')
+			return SB_FALSE;
 	}
-#else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
-#endif
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+	return SB_TRUE;
 }
+#endif
 
-
-/* --- DISK ROUTINE --- */
-static void *sb_disk_routine(void *thunk)
+static SB_BOOL sb_cpu_usage_init(sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
+#ifdef BUILD_CPU_USAGE
+	size_t num;
 
-#ifdef BUILD_DISK
-	SB_TIMER_VARS;
-	size_t         num_filesystems;
-	int            i;
-	struct statvfs stats;
-	long           avail;
-	char           avail_unit;
-	long           total;
-	char           total_unit;
-	long           perc;
-	char           output[512];
-	int            color_level;
+	memset(&sb_cpu_usage, 0, sizeof(sb_cpu_usage));
+	sb_cpu_usage.stat.fd = -1;
 
-	while (routine->run) {
-		SB_START_TIMER;
+	sb_cpu_usage.num_cpus  = get_nprocs_conf();
+	if (sb_cpu_usage.num_cpus < 1) {
+		sb_print_error(routine, "Failed to get number of cores");
+		return SB_FALSE;
+	}
+	num                    = sb_cpu_usage.num_cpus + 1;
+	sb_cpu_usage.busy      = calloc(num, sizeof(*sb_cpu_usage.busy));
+	sb_cpu_usage.total     = calloc(num, sizeof(*sb_cpu_usage.total));
+	sb_cpu_usage.old_busy  = calloc(num, sizeof(*sb_cpu_usage.old_busy));
+	sb_cpu_usage.old_total = calloc(num, sizeof(*sb_cpu_usage.old_total));
+	sb_cpu_usage.perc      = calloc(num, sizeof(*sb_cpu_usage.perc));
+
+	/* Each CPU line takes up to around 100 bytes. */
+	sb_cpu_usage.size = 4096 + (num * 128);
+	sb_cpu_usage.buf  = malloc(sb_cpu_usage.size);
+
+	if (sb_cpu_usage.busy == NULL || sb_cpu_usage.total == NULL || sb_cpu_usage.old_busy == NULL ||
+	    sb_cpu_usage.old_total == NULL || sb_cpu_usage.perc == NULL || sb_cpu_usage.buf == NULL) {
+		sb_print_error(routine, "Failed to allocate memory");
+		return SB_FALSE;
+	}
+	sb_debug(__func__, "init: tracking %d cores", sb_cpu_usage.num_cpus);
 
-		/* In this routine, we're going to lock the mutex for the entire operation so we
-		 * can safely add to the routine's output for the entire loop. */
-		pthread_mutex_lock(&(routine->mutex));
-		*routine->output = '\0';
-
-		color_level     = 1;
-		routine->color  = routine->colors.normal; /* start at normal */
-		num_filesystems = sizeof(filesystems) / sizeof(*filesystems);
-		sb_debug(__func__, "reading %zu filesystems", num_filesystems);
-		for (i=0; i<num_filesystems; i++) {
-			if (statvfs(filesystems[i].path, &stats) != 0) {
-				sb_print_error(routine, "Failed to get stats for %s", filesystems[i].path);
-				break;
-			}
-			avail = (long)sb_calc_magnitude(stats.f_bfree *stats.f_bsize, &avail_unit);
-			total = (long)sb_calc_magnitude(stats.f_blocks*stats.f_bsize, &total_unit);
-			/* chose highest warning for any filesystem */
-			perc = sb_normalize_perc((avail*100)/total);
-			if (perc >= 90) {
-				color_level    = 3;
-				routine->color = routine->colors.error;
-			} else if (perc >= 75 && color_level < 3) {
-				color_level    = 2;
-				routine->color = routine->colors.warning;
-			}
+	if (!sb_file_open(&sb_cpu_usage.stat, "/proc/stat", NULL, routine))
+		return SB_FALSE;
 
-			snprintf(output, sizeof(output), "%s: %ld%c/%ld%c",
-					filesystems[i].display_name, avail, avail_unit, total, total_unit);
-			strncat(routine->output, output, sizeof(routine->output)-strlen(routine->output)-1);
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_cpu_usage_update(sb_routine_t *routine)
+{
+#ifdef BUILD_CPU_USAGE
+	unsigned long  used;
+	unsigned long  total;
+	unsigned long  elapsed;
+	long          *perc = sb_cpu_usage.perc;
+	long           hottest = 1;
+	char          *buf;
+	char           output[256];
+	size_t         len;
+	int            num = sb_cpu_usage.num_cpus + 1;
+	int            i;
+	int            j;
+	const char    *color;
+
+	while (1) {
+		if (!sb_file_read(&sb_cpu_usage.stat, sb_cpu_usage.buf, sb_cpu_usage.size, routine))
+			return SB_FALSE;
+		if (sb_cpu_usage_parse())
+			break;
 
-			if (i+1 < num_filesystems)
-				strncat(routine->output, ", ", sizeof(routine->output)-strlen(routine->output)-1);
+		if (sb_cpu_usage.size >= 1024 * 1024 ||
+		    (buf = realloc(sb_cpu_usage.buf, sb_cpu_usage.size * 2)) == NULL) {
+			sb_print_error(routine, "Failed to read %s", sb_cpu_usage.stat.path);
+			return SB_FALSE;
 		}
-		pthread_mutex_unlock(&(routine->mutex));
+		sb_cpu_usage.buf   = buf;
+		sb_cpu_usage.size *= 2;
+		sb_debug(__func__, "buffer grown to %zu bytes", sb_cpu_usage.size);
+	}
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+	/* Work out the usage of every core in one pass over the arrays. */
+	for (i=0; i<num; i++) {
+		used  = sb_cpu_usage.busy[i]  - sb_cpu_usage.old_busy[i];
+		total = sb_cpu_usage.total[i] - sb_cpu_usage.old_total[i];
+		perc[i] = total > 0 ? (long)((used * 100) / total) : 0;
+	}
+	elapsed = sb_cpu_usage.total[0] - sb_cpu_usage.old_total[0];
+	memcpy(sb_cpu_usage.old_busy,  sb_cpu_usage.busy,  num * sizeof(*sb_cpu_usage.busy));
+	memcpy(sb_cpu_usage.old_total, sb_cpu_usage.total, num * sizeof(*sb_cpu_usage.total));
+
+	for (i=2; i<num; i++) {
+		if (perc[i] > perc[hottest])
+			hottest = i;
+	}
+
+	perc[0] = sb_normalize_perc(perc[0]);
+	if (perc[0] < 75) {
+		color = routine->colors.normal;
+	} else if (perc[0] < 90) {
+		color = routine->colors.warning;
+	} else {
+		color = routine->colors.error;
+	}
+
+	len = snprintf(output, sizeof(output), "%2ld%% CPU", perc[0]);
+	if (cpu_show_hottest && num > 2 && len < sizeof(output)) {
+		len += snprintf(output + len, sizeof(output) - len, " (core %ld: %ld%%)", hottest - 1,
+				sb_normalize_perc(perc[hottest]));
+	}
+
+	/* Add the share of the total time that went to each part the user asked for. */
+	for (i=0; i<(int)(sizeof(sb_cpu_times) / sizeof(*sb_cpu_times)) && len < sizeof(output); i++) {
+		if (!(cpu_breakdown & (1 << i)))
+			continue;
+
+		used = 0;
+		for (j=0; j<2; j++) {
+			if (sb_cpu_times[i].fields[j] >= 0)
+				used += sb_cpu_usage.fields[sb_cpu_times[i].fields[j]] -
+				        sb_cpu_usage.old_fields[sb_cpu_times[i].fields[j]];
+		}
+		len += snprintf(output + len, sizeof(output) - len, " %s %lu%%", sb_cpu_times[i].label,
+				elapsed > 0 ? (used * 100) / elapsed : 0);
 	}
+	memcpy(sb_cpu_usage.old_fields, sb_cpu_usage.fields, sizeof(sb_cpu_usage.fields));
+
+	sb_publish(routine, color, "%s", output);
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_cpu_usage_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_CPU_USAGE
+	sb_file_close(&sb_cpu_usage.stat);
+	free(sb_cpu_usage.buf);
+	free(sb_cpu_usage.busy);
+	free(sb_cpu_usage.total);
+	free(sb_cpu_usage.old_busy);
+	free(sb_cpu_usage.old_total);
+	free(sb_cpu_usage.perc);
+	sb_cpu_usage.buf  = NULL;
+	sb_cpu_usage.busy = sb_cpu_usage.total = sb_cpu_usage.old_busy = sb_cpu_usage.old_total = NULL;
+	sb_cpu_usage.perc = NULL;
+#else
+	(void)cpu_show_hottest;
+	(void)cpu_breakdown;
+#endif
+	(void)routine;
+}
+
+
+/* --- DISK ROUTINE --- */
+static SB_BOOL sb_disk_init(sb_routine_t *routine)
+{
+#ifdef BUILD_DISK
+	(void)routine;
+	return SB_TRUE;
 #else
 	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
 #endif
+}
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+static SB_BOOL sb_disk_update(sb_routine_t *routine)
+{
+#ifdef BUILD_DISK
+	size_t         num_filesystems;
+	int            i;
+	struct statvfs stats;
+	long           avail;
+	char           avail_unit;
+	long           total;
+	char           total_unit;
+	long           perc;
+	char           output[sizeof(routine->output)];
+	char           buf[512];
+	int            color_level;
+	const char    *color;
+
+	/* We're going to build the output for all filesystems first and then publish it in one go. */
+	*output = '\0';
+
+	color_level     = 1;
+	color           = routine->colors.normal; /* start at normal */
+	num_filesystems = sizeof(filesystems) / sizeof(*filesystems);
+	sb_debug(__func__, "reading %zu filesystems", num_filesystems);
+	for (i=0; i<num_filesystems; i++) {
+		if (statvfs(filesystems[i].path, &stats) != 0) {
+			sb_print_error(routine, "Failed to get stats for %s", filesystems[i].path);
+			return SB_FALSE;
+		}
+		avail = (long)sb_calc_magnitude(stats.f_bfree *stats.f_bsize, &avail_unit);
+		total = (long)sb_calc_magnitude(stats.f_blocks*stats.f_bsize, &total_unit);
+		/* chose highest warning for any filesystem */
+		perc = sb_normalize_perc((avail*100)/total);
+		if (perc >= 90) {
+			color_level = 3;
+			color       = routine->colors.error;
+		} else if (perc >= 75 && color_level < 3) {
+			color_level = 2;
+			color       = routine->colors.warning;
+		}
+
+		snprintf(buf, sizeof(buf), "%s: %ld%c/%ld%c",
+				filesystems[i].display_name, avail, avail_unit, total, total_unit);
+		strncat(output, buf, sizeof(output)-strlen(output)-1);
+
+		if (i+1 < num_filesystems)
+			strncat(output, ", ", sizeof(output)-strlen(output)-1);
+	}
+
+	sb_publish(routine, color, "%s", output);
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+
+/* --- DISK I/O ROUTINE --- */
+#ifdef BUILD_DISKIO
+#define SB_DISKIO_MOUNTS (sizeof(filesystems) / sizeof(*filesystems))
+
+/* Where to find the mounts. This can be defined at build time to test against a fixture. */
+#ifndef SB_DISKIO_MOUNTINFO
+  #define SB_DISKIO_MOUNTINFO "/proc/self/mountinfo"
+#endif
+
+/* Counters from a line of /proc/diskstats. Sectors are always 512 bytes there. */
+struct sb_diskio_stats {
+	unsigned long reads;      /* reads completed */
+	unsigned long read_secs;  /* sectors read */
+	unsigned long read_ms;    /* milliseconds spent reading */
+	unsigned long writes;     /* writes completed */
+	unsigned long write_secs; /* sectors written */
+	unsigned long write_ms;   /* milliseconds spent writing */
+	unsigned long io_ms;      /* milliseconds spent with I/O in flight */
+};
+
+static struct {
+	sb_file_t        diskstats;
+	char            *buf;
+	size_t           size;
+	struct timespec  old_tp;
+	struct {
+		unsigned int           major;
+		unsigned int           minor;   /* major and minor of 0 means the mount isn't on a block device */
+		SB_BOOL                found;   /* SB_TRUE if the device was in the latest sample. */
+		struct sb_diskio_stats new_stats;
+		struct sb_diskio_stats old_stats;
+	} devices[SB_DISKIO_MOUNTS];
+} sb_diskio;
+
+static void sb_diskio_unescape(char *str)
+{
+	/* The kernel writes spaces, tabs, newlines, and backslashes in mountinfo fields as
+	 * three-digit octal escapes (a space is "\040"). This will decode them in place. */
+	char *out = str;
+
+	for (; *str != '\0'; str++, out++) {
+		if (str[0] == '\\' && str[1] >= '0' && str[1] <= '3' && str[2] >= '0' && str[2] <= '7' &&
+		    str[3] >= '0' && str[3] <= '7') {
+			*out = (char)(((str[1] - '0') << 6) | ((str[2] - '0') << 3) | (str[3] - '0'));
+			str += 3;
+		} else {
+			*out = *str;
+		}
+	}
+	*out = '\0';
+}
+
+static SB_BOOL sb_diskio_find_device(const char *path, unsigned int *major, unsigned int *minor)
+{
+	/* This will look through /proc/self/mountinfo for the filesystem mounted at path and get
+	 * the device number of the block device behind it. Each line looks like this:
+	 * 36 35 8:2 / /home rw,relatime shared:1 - ext4 /dev/sda2 rw
+	 * If the same path is mounted more than once, the last mount is the one that is visible.
+	 * Filesystems like btrfs report an anonymous device number, so for them the device
+	 * number is taken from the mount source instead. */
+	FILE         *file;
+	char          line[1024];
+	char          mount[512];
+	char          source[512];
+	char         *sep;
+	unsigned int  maj;
+	unsigned int  min;
+	struct stat   st;
+	SB_BOOL       found = SB_FALSE;
+
+	file = fopen(SB_DISKIO_MOUNTINFO, "re");
+	if (file == NULL)
+		return SB_FALSE;
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "%*d %*d %u:%u %*s %511s", &maj, &min, mount) != 3)
+			continue;
+		sb_diskio_unescape(mount);
+		if (strcmp(mount, path) != 0)
+			continue;
+
+		sep = strstr(line, " - ");
+		if (sep == NULL || sscanf(sep, " - %*s %511s", source) != 1)
+			continue;
+		sb_diskio_unescape(source);
+
+		if (maj == 0 && stat(source, &st) == 0 && S_ISBLK(st.st_mode)) {
+			maj = major(st.st_rdev);
+			min = minor(st.st_rdev);
+		}
+
+		*major = maj;
+		*minor = min;
+		found  = maj != 0 ? SB_TRUE : SB_FALSE;
+	}
+
+	fclose(file);
+	return found;
+}
+
+static SB_BOOL sb_diskio_parse(void)
+{
+	/* This will pick out the lines for our devices. Returns SB_FALSE if the buffer ran out
+	 * before the end of the file. */
+	const char             *ptr = sb_diskio.buf;
+	char                   *end;
+	unsigned long           maj;
+	unsigned long           min;
+	struct sb_diskio_stats  stats;
+	size_t                  i;
+
+	if (strlen(sb_diskio.buf) >= sb_diskio.size - 1)
+		return SB_FALSE;
+
+	for (i=0; i<SB_DISKIO_MOUNTS; i++)
+		sb_diskio.devices[i].found = SB_FALSE;
+
+	while (*ptr != '\0') {
+		maj = strtoul(ptr, &end, 10);
+		min = strtoul(end, &end, 10);
+
+		for (i=0; i<SB_DISKIO_MOUNTS; i++) {
+			if (sb_diskio.devices[i].major != maj || sb_diskio.devices[i].minor != min || maj == 0)
+				continue;
+
+			memset(&stats, 0, sizeof(stats));
+			sscanf(end, " %*s %lu %*u %lu %lu %lu %*u %lu %lu %*u %lu", &stats.reads, &stats.read_secs,
+					&stats.read_ms, &stats.writes, &stats.write_secs, &stats.write_ms, &stats.io_ms);
+			sb_diskio.devices[i].new_stats = stats;
+			sb_diskio.devices[i].found     = SB_TRUE;
+		}
+
+		ptr = strchr(end, '\n');
+		if (ptr == NULL)
+			break;
+		ptr++;
+	}
+
+	return SB_TRUE;
+}
+#endif
+
+static SB_BOOL sb_diskio_init(sb_routine_t *routine)
+{
+	/* The block device behind each filesystem in config.h is looked up once here, so that
+	 * every update only has to read /proc/diskstats. */
+#ifdef BUILD_DISKIO
+	size_t i;
+	int    num_found = 0;
+
+	memset(&sb_diskio, 0, sizeof(sb_diskio));
+	sb_diskio.diskstats.fd = -1;
+
+	for (i=0; i<SB_DISKIO_MOUNTS; i++) {
+		if (!sb_diskio_find_device(filesystems[i].path, &sb_diskio.devices[i].major, &sb_diskio.devices[i].minor)) {
+			sb_debug(__func__, "init: no block device for %s", filesystems[i].path);
+			sb_diskio.devices[i].major = 0;
+			sb_diskio.devices[i].minor = 0;
+			continue;
+		}
+		sb_debug(__func__, "init: %s is on device %u:%u", filesystems[i].path,
+				sb_diskio.devices[i].major, sb_diskio.devices[i].minor);
+		num_found++;
+	}
+
+	if (num_found == 0) {
+		sb_print_error(routine, "Failed to find block devices for filesystems");
+		return SB_FALSE;
+	}
+
+	sb_diskio.size = 8192;
+	sb_diskio.buf  = malloc(sb_diskio.size);
+	if (sb_diskio.buf == NULL) {
+		sb_print_error(routine, "Failed to allocate memory");
+		return SB_FALSE;
+	}
+
+	if (!sb_file_open(&sb_diskio.diskstats, "/proc/diskstats", NULL, routine))
+		return SB_FALSE;
+
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_diskio_update(sb_routine_t *routine)
+{
+#ifdef BUILD_DISKIO
+	struct timespec          tp;
+	long                     elapsed_ms;
+	struct sb_diskio_stats  *new_stats;
+	struct sb_diskio_stats  *old_stats;
+	unsigned long            ios;
+	long                     read_bytes;
+	char                     read_unit;
+	long                     write_bytes;
+	char                     write_unit;
+	double                   await;
+	long                     perc;
+	long                     busiest = 0;
+	char                     output[sizeof(routine->output)];
+	size_t                   len = 0;
+	char                    *buf;
+	size_t                   i;
+	const char              *color;
+
+	while (1) {
+		if (!sb_file_read(&sb_diskio.diskstats, sb_diskio.buf, sb_diskio.size, routine))
+			return SB_FALSE;
+		if (sb_diskio_parse())
+			break;
+
+		if (sb_diskio.size >= 1024 * 1024 || (buf = realloc(sb_diskio.buf, sb_diskio.size * 2)) == NULL) {
+			sb_print_error(routine, "Failed to read %s", sb_diskio.diskstats.path);
+			return SB_FALSE;
+		}
+		sb_diskio.buf   = buf;
+		sb_diskio.size *= 2;
+		sb_debug(__func__, "buffer grown to %zu bytes", sb_diskio.size);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	elapsed_ms = (tp.tv_sec - sb_diskio.old_tp.tv_sec) * 1000 + (tp.tv_nsec - sb_diskio.old_tp.tv_nsec) / 1000000;
+	if (elapsed_ms < 1)
+		elapsed_ms = 1;
+
+	*output = '\0';
+	for (i=0; i<SB_DISKIO_MOUNTS; i++) {
+		if (!sb_diskio.devices[i].found)
+			continue;
+
+		/* On the first run there is nothing to compare against, so everything comes out
+		 * as 0. */
+		new_stats = &(sb_diskio.devices[i].new_stats);
+		old_stats = &(sb_diskio.devices[i].old_stats);
+		if (sb_diskio.old_tp.tv_sec == 0 && sb_diskio.old_tp.tv_nsec == 0)
+			*old_stats = *new_stats;
+
+		ios         = (new_stats->reads - old_stats->reads) + (new_stats->writes - old_stats->writes);
+		read_bytes  = (long)sb_calc_magnitude(((new_stats->read_secs  - old_stats->read_secs)  * 512 * 1000) / elapsed_ms, &read_unit);
+		write_bytes = (long)sb_calc_magnitude(((new_stats->write_secs - old_stats->write_secs) * 512 * 1000) / elapsed_ms, &write_unit);
+		await       = ios > 0 ? (double)((new_stats->read_ms - old_stats->read_ms) +
+		                                 (new_stats->write_ms - old_stats->write_ms)) / ios : 0;
+
+		/* The color follows the busiest device, by the share of time it had I/O in flight. */
+		perc = sb_normalize_perc(((new_stats->io_ms - old_stats->io_ms) * 100) / elapsed_ms);
+		if (perc > busiest)
+			busiest = perc;
+
+		if (len < sizeof(output)) {
+			len += snprintf(output + len, sizeof(output) - len, "%s%s: %ld%c read/%ld%c write %lu IOPS %.1fms",
+					len > 0 ? ", " : "", filesystems[i].display_name, read_bytes, read_unit,
+					write_bytes, write_unit, (ios * 1000) / elapsed_ms, await);
+		}
+
+		*old_stats = *new_stats;
+	}
+	sb_diskio.old_tp = tp;
+
+	if (busiest < 75) {
+		color = routine->colors.normal;
+	} else if (busiest < 90) {
+		color = routine->colors.warning;
+	} else {
+		color = routine->colors.error;
+	}
+
+	sb_publish(routine, color, "%s", output);
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_diskio_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_DISKIO
+	sb_file_close(&sb_diskio.diskstats);
+	free(sb_diskio.buf);
+	sb_diskio.buf = NULL;
+#endif
+	(void)routine;
 }
 
 
 /* --- FAN ROUTINE --- */
 #ifdef BUILD_FAN
+static struct {
+	char      path[512];
+	long      max;
+	sb_file_t output;
+} sb_fan;
+
 static SB_BOOL sb_fan_get_path(char path[], size_t size, sb_routine_t *routine)
 {
 	/* This will open the directory at base and look through every subdirectory
@@ -598,1169 +1352,3589 @@ static SB_BOOL sb_fan_get_path(char path[], size_t size, sb_routine_t *routine)
 }
 #endif
 
-static void *sb_fan_routine(void *thunk)
+static SB_BOOL sb_fan_init(sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
-
 #ifdef BUILD_FAN
-	SB_TIMER_VARS;
-	char path[512];
 	char contents[128];
-	long max;
-	long now;
-	long perc;
 
-	if (!sb_fan_get_path(path, sizeof(path), routine)) {
-		routine->run = SB_FALSE;
-	} else if (!sb_read_file(contents, sizeof(contents), path, "_max", routine)) {
-		sb_print_error(routine, "%s routine: Failed to read %s_max", path);
-		routine->run = SB_FALSE;
-	} else {
-		strncat(path, "_output", sizeof(path)-strlen(path)-1);
-		sb_debug(__func__, "init: found %s", path);
-		max = atol(contents);
-		if (max < 0)
-			routine->run = SB_FALSE;
+	sb_fan.output.fd = -1;
+	if (!sb_fan_get_path(sb_fan.path, sizeof(sb_fan.path), routine))
+		return SB_FALSE;
+
+	if (!sb_read_file(contents, sizeof(contents), sb_fan.path, "_max", routine)) {
+		sb_print_error(routine, "Failed to read %s_max", sb_fan.path);
+		return SB_FALSE;
 	}
-	sb_leak_check(__func__);
 
-	while (routine->run) {
-		SB_START_TIMER;
+	sb_fan.max = atol(contents);
+	if (sb_fan.max < 0)
+		return SB_FALSE;
 
-		if (!sb_read_file(contents, sizeof(contents), path, NULL, routine))
-			break;
+	if (!sb_file_open(&sb_fan.output, sb_fan.path, "_output", routine))
+		return SB_FALSE;
+	sb_debug(__func__, "init: found %s", sb_fan.output.path);
 
-		now = atol(contents);
-		if (now < 0) {
-			sb_print_error(routine, "Failed to read current fan speed");
-			break;
-		}
-		perc = sb_normalize_perc((now*100)/max);
-		if (perc < 75) {
-			routine->color = routine->colors.normal;
-		} else if (perc < 90) {
-			routine->color = routine->colors.warning;
-		} else {
-			routine->color = routine->colors.error;
-		}
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%ld RPM", now);
-		pthread_mutex_unlock(&(routine->mutex));
+static SB_BOOL sb_fan_update(sb_routine_t *routine)
+{
+#ifdef BUILD_FAN
+	char        contents[128];
+	long        now;
+	long        perc;
+	const char *color;
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+	if (!sb_file_read(&sb_fan.output, contents, sizeof(contents), routine))
+		return SB_FALSE;
+
+	now = atol(contents);
+	if (now < 0) {
+		sb_print_error(routine, "Failed to read current fan speed");
+		return SB_FALSE;
 	}
+	perc = sb_normalize_perc((now*100)/sb_fan.max);
+	if (perc < 75) {
+		color = routine->colors.normal;
+	} else if (perc < 90) {
+		color = routine->colors.warning;
+	} else {
+		color = routine->colors.error;
+	}
+
+	sb_publish(routine, color, "%ld RPM", now);
+
+	return SB_TRUE;
 #else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	(void)routine;
+	return SB_FALSE;
 #endif
+}
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+static void sb_fan_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_FAN
+	sb_file_close(&sb_fan.output);
+#endif
+	(void)routine;
 }
 
 
 /* --- LOAD ROUTINE --- */
-static void *sb_load_routine(void *thunk)
+static SB_BOOL sb_load_init(sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
-
 #ifdef BUILD_LOAD
-	SB_TIMER_VARS;
-	double loads[3];
+	(void)routine;
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
 
-	while (routine->run) {
-		SB_START_TIMER;
+static SB_BOOL sb_load_update(sb_routine_t *routine)
+{
+#ifdef BUILD_LOAD
+	double      loads[3];
+	const char *color;
 
-		if (getloadavg(loads, 3) != 3) {
-			sb_print_error(routine, "Failed to read loads");
-			break;
-		}
+	if (getloadavg(loads, 3) != 3) {
+		sb_print_error(routine, "Failed to read loads");
+		return SB_FALSE;
+	}
 
-		if (loads[0] >= 2 || loads[1] >= 2 || loads[2] >= 2) {
-			routine->color = routine->colors.error;
-		} else if (loads[0] >= 1 || loads[1] >= 1 || loads[2] >= 1) {
-			routine->color = routine->colors.warning;
-		} else {
-			routine->color = routine->colors.normal;
-		}
+	if (loads[0] >= 2 || loads[1] >= 2 || loads[2] >= 2) {
+		color = routine->colors.error;
+	} else if (loads[0] >= 1 || loads[1] >= 1 || loads[2] >= 1) {
+		color = routine->colors.warning;
+	} else {
+		color = routine->colors.normal;
+	}
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%.2lf, %.2lf, %.2lf", loads[0], loads[1], loads[2]);
-		pthread_mutex_unlock(&(routine->mutex));
+	sb_publish(routine, color, "%.2lf, %.2lf, %.2lf", loads[0], loads[1], loads[2]);
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
-	}
+	return SB_TRUE;
 #else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	(void)routine;
+	return SB_FALSE;
 #endif
-
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
 }
 
 
 /* --- NETWORK ROUTINE --- */
 #ifdef BUILD_NETWORK
 struct sb_network_t {
-	char path[IFNAMSIZ+64];
 	long old_bytes; /* bytes from the last run */
 	long new_bytes; /* bytes from the current run */
 	long reduced;   /* bytes reduced to the thousands */
 	char unit;
 };
 
-static SB_BOOL sb_network_get_paths(struct sb_network_t *rx_file, struct sb_network_t *tx_file, sb_routine_t *routine)
-{
-	/* This will get all the network interfaces and look for one that is running
- 	 * and not a loopback. */
-	int             sock;
-	struct ifreq    ifr;
-	struct ifaddrs *ifaddrs = NULL;
-	struct ifaddrs *ifap;
+/* Interface found in a link dump. */
+struct sb_network_link {
+	int  index;           /* Interface index, or 0 if no interface is up. */
+	char name[IFNAMSIZ];
+	long bytes[2];        /* Received and sent bytes. */
+};
 
-	sb_debug(__func__, "init: finding interface path");
+static struct {
+	int                 request; /* Netlink socket for asking for link statistics. */
+	int                 events;  /* Netlink socket that is told about link changes. */
+	uint32_t            seq;     /* Sequence number of the last request. */
+	int                 index;   /* Interface being shown, or 0 if none is up. */
+	char                name[IFNAMSIZ];
+	struct sb_network_t bytes[2]; /* [0] is for receiving, [1] is for sending. */
+} sb_network;
 
-	/* open socket and return file descriptor for it */
-	sock = socket(AF_INET, SOCK_DGRAM, 0);
-	if (sock < 0) {
-		sb_print_error(routine, "Failed to open socket file descriptor");
-		return SB_FALSE;
+static void sb_network_parse_link(struct nlmsghdr *nlh, struct sb_network_link *link)
+{
+	/* This will check one link from the dump, and keep it if it is up and is either the
+	 * interface we are already showing or the first usable one we've seen. */
+	struct ifinfomsg           *ifi = NLMSG_DATA(nlh);
+	struct rtattr              *rta;
+	int                         len = IFLA_PAYLOAD(nlh);
+	struct rtnl_link_stats64    stats;
+	const char                 *name = NULL;
+	SB_BOOL                     have_stats = SB_FALSE;
+
+	if (!(ifi->ifi_flags & IFF_RUNNING) || (ifi->ifi_flags & IFF_LOOPBACK))
+		return;
+	if (link->index != 0 && (link->index == sb_network.index || ifi->ifi_index != sb_network.index))
+		return;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME) {
+			name = RTA_DATA(rta);
+		} else if (rta->rta_type == IFLA_STATS64 && RTA_PAYLOAD(rta) >= sizeof(stats)) {
+			memcpy(&stats, RTA_DATA(rta), sizeof(stats)); /* may not be aligned */
+			have_stats = SB_TRUE;
+		}
 	}
-	sb_debug(__func__, "init: opened socket");
 
-	/* get all network interfaces */
-	if (getifaddrs(&ifaddrs) < 0 || ifaddrs == NULL) {
-		sb_print_error(routine, "Failed to find interface addresses");
-		close(sock);
+	if (name == NULL || !have_stats)
+		return;
+
+	link->index    = ifi->ifi_index;
+	link->bytes[0] = stats.rx_bytes;
+	link->bytes[1] = stats.tx_bytes;
+	snprintf(link->name, sizeof(link->name), "%s", name);
+}
+
+static SB_BOOL sb_network_dump(struct sb_network_link *link, sb_routine_t *routine)
+{
+	/* This will get the statistics of every link in one round trip to the kernel, and pick
+	 * the interface to show: the current one if it is still up, otherwise the first one that
+	 * is running and not a loopback. */
+	struct {
+		struct nlmsghdr  nlh;
+		struct ifinfomsg ifi;
+	} req;
+	char             buf[16384] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	struct nlmsghdr *nlh;
+	int              len;
+	SB_BOOL          done = SB_FALSE;
+
+	memset(link, 0, sizeof(*link));
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len   = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nlh.nlmsg_type  = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq   = ++sb_network.seq;
+	req.ifi.ifi_family  = AF_UNSPEC;
+
+	if (send(sb_network.request, &req, req.nlh.nlmsg_len, 0) < 0) {
+		sb_print_error(routine, "Failed to request link statistics");
 		return SB_FALSE;
 	}
-	ifap = ifaddrs;
-	sb_debug(__func__, "init: got list of interfaces");
 
-	/* go through each interface until we find an active one */
-	while (ifap != NULL) {
-		strncpy(ifr.ifr_name, ifap->ifa_name, IFNAMSIZ);
-		if (ioctl(sock, SIOCGIFFLAGS, &ifr) >= 0) {
-			if (ifr.ifr_flags & IFF_RUNNING && !(ifr.ifr_flags & IFF_LOOPBACK)) {
-				snprintf(rx_file->path, sizeof(rx_file->path),
-						"/sys/class/net/%s/statistics/rx_bytes", ifap->ifa_name);
-				snprintf(tx_file->path, sizeof(tx_file->path),
-						"/sys/class/net/%s/statistics/tx_bytes", ifap->ifa_name);
+	while (!done) {
+		len = recv(sb_network.request, buf, sizeof(buf), 0);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		} else if (len <= 0) {
+			sb_print_error(routine, "Failed to receive link statistics");
+			return SB_FALSE;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != sb_network.seq) {
+				continue;
+			} else if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = SB_TRUE;
 				break;
+			} else if (nlh->nlmsg_type == NLMSG_ERROR) {
+				sb_print_error(routine, "Kernel returned an error for link statistics");
+				return SB_FALSE;
+			} else if (nlh->nlmsg_type == RTM_NEWLINK) {
+				sb_network_parse_link(nlh, link);
 			}
 		}
-		ifap = ifap->ifa_next;
 	}
 
-	close(sock);
-	freeifaddrs(ifaddrs);
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_network_select(const struct sb_network_link *link)
+{
+	/* Switch to the interface in link if it isn't the one being shown. Counting starts over
+	 * from its current statistics. Returns SB_TRUE if the interface changed. */
+	int i;
 
-	if (ifap == NULL) {
-		sb_print_error(routine, "No wireless interfaces found");
+	if (link->index == sb_network.index)
 		return SB_FALSE;
+
+	if (link->index == 0)
+		sb_debug("Network", "no interface is up");
+	else
+		sb_debug("Network", "using %s", link->name);
+
+	sb_network.index = link->index;
+	snprintf(sb_network.name, sizeof(sb_network.name), "%s", link->name);
+	for (i=0; i<2; i++) {
+		sb_network.bytes[i].old_bytes = link->bytes[i];
+		sb_network.bytes[i].new_bytes = link->bytes[i];
 	}
 
 	return SB_TRUE;
 }
-#endif
 
-static void *sb_network_routine(void *thunk)
+static SB_BOOL sb_network_affects(struct nlmsghdr *nlh)
 {
-	/* This routine is going to read two files, rx_bytes and tx_bytes, for the current
- 	 * up-and-running network interface. It will compare the number of bytes between
-	 * loops to get the current network throughput. */
-	sb_routine_t *routine = thunk;
+	/* This will check whether a link change could change the interface to show. The interface
+	 * being shown is kept for as long as it is running, so that only matters if it stops
+	 * running or goes away, or if nothing is shown and some other link starts running.
+	 * Anything else, like the steady stream of changes from wireless drivers, is ignored. */
+	struct ifinfomsg *ifi;
+
+	if ((nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK) ||
+	    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return SB_FALSE;
 
-#ifdef BUILD_NETWORK
-	SB_TIMER_VARS;
-	struct sb_network_t files[2] = {0};
-	SB_BOOL             error;
-	int                 i;
-	char                contents[128];
-	int                 color_level;
+	ifi = NLMSG_DATA(nlh);
+	if (sb_network.index == 0)
+		return (ifi->ifi_flags & IFF_RUNNING) && !(ifi->ifi_flags & IFF_LOOPBACK);
+	if (ifi->ifi_index != sb_network.index)
+		return SB_FALSE;
 
-	if (!sb_network_get_paths(&files[0], &files[1], routine)) {
-		routine->run = SB_FALSE;
-	} else {
-		sb_debug(__func__, "init: found %s for receiving", files[0].path);
-		sb_debug(__func__, "init: found %s for sending", files[1].path);
+	return nlh->nlmsg_type == RTM_DELLINK || !(ifi->ifi_flags & IFF_RUNNING);
+}
+#endif
+
+static SB_BOOL sb_network_init(sb_routine_t *routine)
+{
+	/* This routine is going to ask the kernel for the byte counters of the current
+ 	 * up-and-running network interface over netlink, and compare the number of bytes
+	 * between loops to get the current network throughput. A second netlink socket is
+	 * told whenever a link changes, so that a new interface (VPN, tethering, docking) is
+	 * picked up without restarting. */
+#ifdef BUILD_NETWORK
+	struct sockaddr_nl     addr;
+	struct sb_network_link link;
+
+	memset(&sb_network, 0, sizeof(sb_network));
+	sb_network.events  = -1;
+	sb_network.request = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sb_network.request < 0) {
+		sb_print_error(routine, "Failed to open netlink socket");
+		return SB_FALSE;
 	}
-	sb_leak_check(__func__);
 
-	while (routine->run) {
-		SB_START_TIMER;
+	sb_network.events = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (sb_network.events < 0) {
+		sb_print_error(routine, "Failed to open netlink socket");
+		return SB_FALSE;
+	}
 
-		color_level    = 1;
-		routine->color = routine->colors.normal;
-		error = SB_FALSE;
-		for (i=0; i<2 && !error; i++) {
-			files[i].old_bytes = files[i].new_bytes;
-			if (!sb_read_file(contents, sizeof(contents), files[i].path, NULL, routine)) {
-				error = SB_TRUE;
-			} else if (sscanf(contents, "%ld", &files[i].new_bytes) != 1) {
-				sb_print_error(routine, "Failed to read %s", files[i].path);
-				error = SB_TRUE;
-			} else {
-				files[i].reduced = (long)sb_calc_magnitude(files[i].new_bytes - files[i].old_bytes, &files[i].unit);
-				if (files[i].unit == 'B' || files[i].unit == 'K') {
-				} else if (files[i].unit == 'M' && color_level < 3) {
-					color_level    = 2;
-					routine->color = routine->colors.warning;
-				} else {
-					color_level    = 3;
-					routine->color = routine->colors.error;
-				}
-			}
-		}
-		if (error)
-			break;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+	if (bind(sb_network.events, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		sb_print_error(routine, "Failed to subscribe to link changes");
+		return SB_FALSE;
+	}
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%3ld%c down/%3ld%c up",
-				files[0].reduced, files[0].unit, files[1].reduced, files[1].unit);
-		pthread_mutex_unlock(&(routine->mutex));
+	if (!sb_network_dump(&link, routine))
+		return SB_FALSE;
+	sb_network_select(&link);
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
-	}
+	return sb_watch_add(routine, sb_network.events, POLLIN);
 #else
 	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
 #endif
-
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
 }
 
-
-/* --- RAM ROUTINE --- */
-static void *sb_ram_routine(void *thunk)
+static SB_BOOL sb_network_update(sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
+#ifdef BUILD_NETWORK
+	struct sb_network_t   *bytes = sb_network.bytes;
+	struct sb_network_link link;
+	int                    i;
+	int                    color_level;
+	const char            *color;
 
-#ifdef BUILD_RAM
-	SB_TIMER_VARS
-	long  page_size;
-	long  avail_l;
-	float avail_f;
-	char  avail_unit;
-	long  total_l;
-	float total_f;
-	char  total_unit;
-	long  perc;
-
-	page_size = sysconf(_SC_PAGESIZE);
-
-	/* calculate available and total bytes */
-	avail_l = sysconf(_SC_AVPHYS_PAGES) * page_size;
-	total_l = sysconf(_SC_PHYS_PAGES)   * page_size;
-	if (avail_l < 1 || total_l < 1) {
-		sb_print_error(routine, "Failed to get memory amounts");
-		routine->run = SB_FALSE;
-	} else {
-		total_f = sb_calc_magnitude(total_l, &total_unit);
-		sb_debug(__func__, "init: calculated total bytes free");
+	if (!sb_network_dump(&link, routine))
+		return SB_FALSE;
+
+	sb_network_select(&link);
+	if (sb_network.index == 0) {
+		sb_publish(routine, routine->colors.error, "No network");
+		return SB_TRUE;
 	}
-	sb_leak_check(__func__);
 
-	while (routine->run) {
-		SB_START_TIMER;
+	color_level = 1;
+	color       = routine->colors.normal;
+	for (i=0; i<2; i++) {
+		bytes[i].old_bytes = bytes[i].new_bytes;
+		bytes[i].new_bytes = link.bytes[i];
+
+		bytes[i].reduced = (long)sb_calc_magnitude(bytes[i].new_bytes - bytes[i].old_bytes, &bytes[i].unit);
+		if (bytes[i].unit == 'B' || bytes[i].unit == 'K') {
+		} else if (bytes[i].unit == 'M' && color_level < 3) {
+			color_level = 2;
+			color       = routine->colors.warning;
+		} else {
+			color_level = 3;
+			color       = routine->colors.error;
+		}
+	}
+
+	sb_publish(routine, color, "%3ld%c down/%3ld%c up",
+			bytes[0].reduced, bytes[0].unit, bytes[1].reduced, bytes[1].unit);
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_network_event(sb_routine_t *routine, int fd, short revents)
+{
+	/* A link changed. Drain the socket, and if any of the changes could mean a different
+	 * interface should be shown, look at every link again. */
+#ifdef BUILD_NETWORK
+	char                   buf[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	struct sb_network_link link;
+	struct nlmsghdr       *nlh;
+	int                    len;
+	SB_BOOL                dump = SB_FALSE;
 
-		/* get available memory */
-		avail_l = sysconf(_SC_AVPHYS_PAGES) * page_size;
-		if (avail_l < 1) {
-			sb_print_error(routine, "Failed to get available bytes");
+	(void)revents;
+	while (1) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len == 0) {
 			break;
+		} else if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS) {
+				/* Some changes were dropped, so we can't tell what they were. */
+				dump = SB_TRUE;
+				continue;
+			}
+			sb_print_error(routine, "Failed to receive link changes");
+			return SB_FALSE;
 		}
 
-		perc  = sb_normalize_perc((avail_l*100)/total_l);
-		if (perc < 75) {
-			routine->color = routine->colors.normal;
-		} else if (perc < 90) {
-			routine->color = routine->colors.warning;
-		} else {
-			routine->color = routine->colors.error;
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (sb_network_affects(nlh))
+				dump = SB_TRUE;
 		}
+	}
 
-		avail_f = sb_calc_magnitude(avail_l, &avail_unit);
-
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "%.1f%c free/%.1f%c",
-				avail_f, avail_unit, total_f, total_unit);
-		pthread_mutex_unlock(&(routine->mutex));
+	if (!dump)
+		return SB_TRUE;
+	sb_debug("Network", "link changes may affect the interface, checking links");
+	if (!sb_network_dump(&link, routine))
+		return SB_FALSE;
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+	/* Show the new interface right away instead of waiting for the next update. */
+	if (sb_network_select(&link)) {
+		if (sb_network.index == 0)
+			sb_publish(routine, routine->colors.error, "No network");
+		else
+			sb_publish(routine, routine->colors.normal, "%3ldB down/%3ldB up", 0L, 0L);
 	}
+
+	return SB_TRUE;
 #else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	(void)routine;
+	(void)fd;
+	(void)revents;
+	return SB_FALSE;
 #endif
+}
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+static void sb_network_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_NETWORK
+	if (sb_network.request >= 0)
+		close(sb_network.request);
+	if (sb_network.events >= 0)
+		close(sb_network.events);
+	sb_network.request = -1;
+	sb_network.events  = -1;
+#endif
+	(void)routine;
 }
 
 
-/* --- TODO ROUTINE --- */
-#ifdef BUILD_TODO
-static int sb_todo_count_blanks(const char *line, SB_BOOL *isempty)
-{
-	int i = 0;
+/* --- PRESSURE ROUTINE --- */
+#ifdef BUILD_PRESSURE
+/* Resources that the kernel reports pressure stall information for. */
+static const struct {
+	const char *file;  /* File in /proc/pressure. */
+	const char *label; /* Name shown in the output. */
+} sb_pressure_resources[] = {
+	{ "cpu"   , "cpu" },
+	{ "memory", "mem" },
+	{ "io"    , "io"  },
+};
 
-	*isempty = SB_FALSE;
+#define SB_PRESSURE_RESOURCES (sizeof(sb_pressure_resources) / sizeof(*sb_pressure_resources))
 
-	switch (*line) {
-		case '\t':
-		case ' ' :
-			while (line[i] && isblank(line[i]) != 0) {
-				i++;
-			}
-			if (!isgraph(line[i]))
-				*isempty = SB_TRUE;
-			return i;
-		case '\n':
-			*isempty = SB_TRUE;
+static struct {
+	sb_file_t        files[SB_PRESSURE_RESOURCES];
+	int              triggers[SB_PRESSURE_RESOURCES]; /* Trigger file descriptors, or -1. */
+	struct timespec  fired[SB_PRESSURE_RESOURCES];    /* When each trigger last fired. */
+} sb_pressure;
+
+static SB_BOOL sb_pressure_parse(const char *buf, double *avg10, double *avg60)
+{
+	/* Each file has a "some" line for the share of time that at least one task was stalled
+	 * and a "full" line for the share of time that all tasks were, like this:
+	 * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+	 * Older kernels don't have a "full" line for the CPU, which is the same as no stalls. */
+	const char *kind = pressure_full ? "full" : "some";
+	const char *line;
+
+	*avg10 = 0;
+	*avg60 = 0;
+
+	for (line = buf; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+		if (*line == '\n')
+			line++;
+		if (strncmp(line, kind, 4) == 0)
+			return sscanf(line + 4, " avg10=%lf avg60=%lf", avg10, avg60) == 2 ? SB_TRUE : SB_FALSE;
 	}
 
-	return 0;
+	return pressure_full ? SB_TRUE : SB_FALSE;
 }
-#endif
 
-static void *sb_todo_routine(void *thunk)
+static SB_BOOL sb_pressure_fired(size_t index)
 {
-	/* We're going to read in the first two lines of the user's personal TODO list
- 	 * and print them based on a few rules:
-	 * 1. If the file is empty, print "Finished".
-	 * 2. If the second line is empty, only print the first line.
-	 * 3. If the second line is indented over from the first, then it is a child
-	 *    task of the first. Print "line1 -> line2".
-	 * 4. If the second line is not indented, both tasks are equal. Print "line1 | line2".
-	 */
-	sb_routine_t *routine = thunk;
-
-#ifdef BUILD_TODO
-	SB_TIMER_VARS;
-	FILE       *fd;
-	char        path[512]  = {0};
-	const char *separator;
-	int         i;
-	struct {
-		char        line[512];
-		const char *ptr;
-		SB_BOOL     isempty;
-	} line[2] = {0};
-
-	snprintf(path, sizeof(path), "%s/%s", getenv("HOME"), todo_path);
-	sb_debug(__func__, "init: using %s", path);
-	sb_leak_check(__func__);
+	/* A trigger fires at most once per window, so treat a resource as stalled for one window
+	 * after its trigger fires. */
+	struct timespec now;
+	long            usec;
 
-	routine->color = routine->colors.normal;
-	while (routine->run) {
-		SB_START_TIMER;
+	if (sb_pressure.fired[index].tv_sec == 0 && sb_pressure.fired[index].tv_nsec == 0)
+		return SB_FALSE;
 
-		fd = fopen(path, "r");
-		if (fd == NULL) {
-			sb_print_error(routine, "Failed to open %s", path);
-			break;
-		} else if (fgets(line[0].line, sizeof(line[0].line), fd) == NULL) {
-			line[0].isempty = SB_TRUE;
-		} else if (fgets(line[1].line, sizeof(line[1].line), fd) == NULL) {
-			line[1].isempty = SB_TRUE;
-		} else if (fclose(fd) != 0) {
-			sb_print_error(routine, "Failed to close %s", path);
-			fclose(fd);
-			break;
-		}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (now.tv_sec - sb_pressure.fired[index].tv_sec) * 1000000 +
+	       (now.tv_nsec - sb_pressure.fired[index].tv_nsec) / 1000;
 
-		if (line[0].isempty || line[1].isempty) {
-			separator = "";
-		} else if (isblank(*line[1].line)) {
-			separator = " -> ";
-		} else {
-			separator = " | ";
-		}
+	return usec < pressure_trigger_window ? SB_TRUE : SB_FALSE;
+}
+#endif
 
-		for (i=0; i<2; i++) {
-			/* reset pointer to beginning of line */
-			line[i].ptr = line[i].line;
+static SB_BOOL sb_pressure_init(sb_routine_t *routine)
+{
+	/* Besides reading the averages every interval, we're going to ask the kernel to tell us
+	 * as soon as the stalls in a window go over pressure_trigger_stall. The kernel wakes
+	 * up trigger file descriptors with POLLPRI. Unprivileged users can only set triggers on
+	 * kernels from 6.5 on, and then only with windows in whole multiples of 2 seconds, so the
+	 * routine carries on without them if the kernel won't take them. */
+#ifdef BUILD_PRESSURE
+	char   trigger[64];
+	int    len;
+	size_t i;
+
+	memset(&sb_pressure, 0, sizeof(sb_pressure));
+	for (i=0; i<SB_PRESSURE_RESOURCES; i++) {
+		sb_pressure.files[i].fd = -1;
+		sb_pressure.triggers[i] = -1;
+	}
 
-			/* advance line pointer until it hits the first non-blank character */
-			if (!line[i].isempty) {
-				line[i].line[strlen(line[i].line)-1] = '\0'; /* don't print newline character */
-				line[i].ptr += sb_todo_count_blanks(line[i].line, &line[i].isempty);
-			}
-		}
+	for (i=0; i<SB_PRESSURE_RESOURCES; i++) {
+		if (!sb_file_open(&sb_pressure.files[i], "/proc/pressure/", sb_pressure_resources[i].file, routine))
+			return SB_FALSE;
+	}
 
-		pthread_mutex_lock(&(routine->mutex));
-		if (line[0].isempty && line[1].isempty) {
-			snprintf(routine->output, sizeof(routine->output), "Finished");
-		} else {
-			snprintf(routine->output, sizeof(routine->output), "%s%s%s",
-					line[0].ptr, separator, line[1].ptr);
+	if (pressure_trigger_stall <= 0)
+		return SB_TRUE;
+
+	len = snprintf(trigger, sizeof(trigger), "%s %ld %ld", pressure_full ? "full" : "some",
+			pressure_trigger_stall, pressure_trigger_window);
+	for (i=0; i<SB_PRESSURE_RESOURCES; i++) {
+		sb_pressure.triggers[i] = open(sb_pressure.files[i].path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (sb_pressure.triggers[i] < 0 || write(sb_pressure.triggers[i], trigger, len + 1) < 0) {
+			sb_debug(__func__, "init: kernel refused trigger for %s", sb_pressure.files[i].path);
+			if (sb_pressure.triggers[i] >= 0)
+				close(sb_pressure.triggers[i]);
+			sb_pressure.triggers[i] = -1;
+			continue;
 		}
-		pthread_mutex_unlock(&(routine->mutex));
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+		if (!sb_watch_add(routine, sb_pressure.triggers[i], POLLPRI))
+			return SB_FALSE;
+		sb_debug(__func__, "init: set trigger \"%s\" for %s", trigger, sb_pressure.files[i].path);
 	}
+
+	return SB_TRUE;
 #else
-	(void)todo_path;
 	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
 #endif
-
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
 }
 
-
-/* --- VOLUME ROUTINE --- */
-#ifdef BUILD_VOLUME
-static SB_BOOL sb_volume_get_snd_elem(snd_mixer_t **mixer, snd_mixer_elem_t **snd_elem, sb_routine_t *routine)
+static SB_BOOL sb_pressure_update(sb_routine_t *routine)
 {
-	static const char    *card   = "hw:0";
-	snd_mixer_selem_id_t *snd_id = NULL;
-	static const int      index  = 0;
-	static const char    *name   = "Master";
+#ifdef BUILD_PRESSURE
+	char        buf[256];
+	char        output[128];
+	size_t      len = 0;
+	double      avg10;
+	double      avg60;
+	double      worst = 0;
+	size_t      i;
+	const char *color;
+
+	for (i=0; i<SB_PRESSURE_RESOURCES; i++) {
+		if (!sb_file_read(&sb_pressure.files[i], buf, sizeof(buf), routine))
+			return SB_FALSE;
 
-	*snd_elem = NULL;
-	*mixer    = NULL;
+		if (!sb_pressure_parse(buf, &avg10, &avg60)) {
+			sb_print_error(routine, "Failed to parse %s", sb_pressure.files[i].path);
+			return SB_FALSE;
+		}
 
-	/* open and load mixer */
-	if (snd_mixer_open(mixer, 0) < 0) {
-		sb_print_error(routine, "Failed to open mixer");
-	} else if (snd_mixer_attach(*mixer, card) < 0) {
-		sb_print_error(routine, "Failed to attach mixer");
-	} else if (snd_mixer_selem_register(*mixer, NULL, NULL) < 0) {
-		sb_print_error(routine, "Failed to register mixer");
-	} else if (snd_mixer_load(*mixer) < 0) {
-		sb_print_error(routine, "Failed to load mixer");
+		/* The averages lag behind a sudden stall, so count a trigger that just fired as
+		 * stalls at its threshold. */
+		if (avg10 > worst)
+			worst = avg10;
+		if (sb_pressure_fired(i) && (pressure_trigger_stall * 100.0) / pressure_trigger_window > worst)
+			worst = (pressure_trigger_stall * 100.0) / pressure_trigger_window;
 
-	/* get id */
-	} else if (snd_mixer_selem_id_malloc(&snd_id) != 0) {
-		sb_print_error(routine, "Failed to allocate snd_id");
+		if (len < sizeof(output)) {
+			len += snprintf(output + len, sizeof(output) - len, "%s%s %.1f/%.1f", i > 0 ? " " : "",
+					sb_pressure_resources[i].label, avg10, avg60);
+		}
+	}
 
-	/* get element */
+	if (worst < pressure_warning) {
+		color = routine->colors.normal;
+	} else if (worst < pressure_error) {
+		color = routine->colors.warning;
 	} else {
-		sb_debug(__func__, "init: opened mixer");
-		sb_debug(__func__, "init: opened id");
+		color = routine->colors.error;
+	}
 
-		snd_mixer_selem_id_set_index(snd_id, index);
-		snd_mixer_selem_id_set_name(snd_id, name);
-		*snd_elem = snd_mixer_find_selem(*mixer, snd_id);
-		snd_mixer_selem_id_free(snd_id);
-		if (*snd_elem == NULL) {
-			sb_print_error(routine, "Failed to find element");
-		} else if (snd_mixer_selem_has_playback_volume(*snd_elem) == 0) {
-			sb_print_error(routine, "Element does not have playback volume");
-		} else {
+	sb_publish(routine, color, "%s", output);
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_pressure_event(sb_routine_t *routine, int fd, short revents)
+{
+#ifdef BUILD_PRESSURE
+	size_t i;
+
+	for (i=0; i<SB_PRESSURE_RESOURCES; i++) {
+		if (sb_pressure.triggers[i] != fd)
+			continue;
+
+		/* The trigger is gone if the kernel reports an error. The file can still be read on
+		 * every interval, so carry on without it. */
+		if (revents & POLLERR) {
+			sb_debug(__func__, "lost trigger for %s, checking every interval", sb_pressure.files[i].path);
+			sb_watch_remove(routine, fd);
+			close(fd);
+			sb_pressure.triggers[i] = -1;
 			return SB_TRUE;
 		}
+
+		sb_debug(__func__, "stall threshold reached for %s", sb_pressure.files[i].path);
+		clock_gettime(CLOCK_MONOTONIC, &sb_pressure.fired[i]);
 	}
 
+	return sb_pressure_update(routine);
+#else
+	(void)routine;
+	(void)fd;
+	(void)revents;
 	return SB_FALSE;
-}
 #endif
+}
 
-static void *sb_volume_routine(void *thunk)
+static void sb_pressure_cleanup(sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
+#ifdef BUILD_PRESSURE
+	size_t i;
+
+	for (i=0; i<SB_PRESSURE_RESOURCES; i++) {
+		sb_file_close(&sb_pressure.files[i]);
+		if (sb_pressure.triggers[i] >= 0)
+			close(sb_pressure.triggers[i]);
+		sb_pressure.triggers[i] = -1;
+	}
+#else
+	(void)pressure_full;
+	(void)pressure_warning;
+	(void)pressure_error;
+	(void)pressure_trigger_stall;
+	(void)pressure_trigger_window;
+#endif
+	(void)routine;
+}
 
-#ifdef BUILD_VOLUME
-	SB_TIMER_VARS;
-	snd_mixer_t      *mixer;
+
+/* --- RAM ROUTINE --- */
+#ifdef BUILD_RAM
+/* Values read out of /proc/meminfo, in kB (HugePages_Total and HugePages_Free are counts). */
+enum sb_ram_key_e {
+	SB_RAM_KEY_MEM_TOTAL = 0,
+	SB_RAM_KEY_MEM_FREE,
+	SB_RAM_KEY_MEM_AVAILABLE,
+	SB_RAM_KEY_BUFFERS,
+	SB_RAM_KEY_CACHED,
+	SB_RAM_KEY_SWAP_TOTAL,
+	SB_RAM_KEY_SWAP_FREE,
+	SB_RAM_KEY_DIRTY,
+	SB_RAM_KEY_WRITEBACK,
+	SB_RAM_KEY_HUGEPAGES_TOTAL,
+	SB_RAM_KEY_HUGEPAGES_FREE,
+	SB_RAM_KEYS,
+};
+
+/* Keys to look for, in the same order as enum sb_ram_key_e. */
+static const struct {
+	const char *key;
+	size_t      len;
+} sb_ram_keys[] = {
+	{ "MemTotal:"       , 9  },
+	{ "MemFree:"        , 8  },
+	{ "MemAvailable:"   , 13 },
+	{ "Buffers:"        , 8  },
+	{ "Cached:"         , 7  },
+	{ "SwapTotal:"      , 10 },
+	{ "SwapFree:"       , 9  },
+	{ "Dirty:"          , 6  },
+	{ "Writeback:"      , 10 },
+	{ "HugePages_Total:", 16 },
+	{ "HugePages_Free:" , 15 },
+};
+
+static struct {
+	sb_file_t     meminfo;
+	char          buf[4096];
+	unsigned long values[SB_RAM_KEYS];
+} sb_ram;
+
+static SB_BOOL sb_ram_parse(void)
+{
+	/* This will go through /proc/meminfo line by line, checking each line's key against the
+	 * ones we want and stopping as soon as all of them have been found. Returns SB_FALSE if
+	 * MemTotal is missing. Keys that older kernels don't have are left at 0. */
+	const char *ptr   = sb_ram.buf;
+	int         found = 0;
+	int         i;
+
+	memset(sb_ram.values, 0, sizeof(sb_ram.values));
+
+	while (*ptr != '\0' && found < SB_RAM_KEYS) {
+		for (i=0; i<SB_RAM_KEYS; i++) {
+			if (ptr[0] == sb_ram_keys[i].key[0] && strncmp(ptr, sb_ram_keys[i].key, sb_ram_keys[i].len) == 0) {
+				sb_ram.values[i] = strtoul(ptr + sb_ram_keys[i].len, NULL, 10);
+				found++;
+				break;
+			}
+		}
+
+		ptr = strchr(ptr, '\n');
+		if (ptr == NULL)
+			break;
+		ptr++;
+	}
+
+	return sb_ram.values[SB_RAM_KEY_MEM_TOTAL] > 0 ? SB_TRUE : SB_FALSE;
+}
+#endif
+
+static SB_BOOL sb_ram_init(sb_routine_t *routine)
+{
+#ifdef BUILD_RAM
+	memset(&sb_ram, 0, sizeof(sb_ram));
+	sb_ram.meminfo.fd = -1;
+
+	if (!sb_file_open(&sb_ram.meminfo, "/proc/meminfo", NULL, routine))
+		return SB_FALSE;
+
+	sb_debug(__func__, "init: opened /proc/meminfo");
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_ram_update(sb_routine_t *routine)
+{
+#ifdef BUILD_RAM
+	unsigned long *values = sb_ram.values;
+	unsigned long  avail;
+	unsigned long  swap;
+	char           output[256];
+	size_t         len;
+	float          value_f;
+	char           value_unit;
+	float          total_f;
+	char           total_unit;
+	long           perc;
+	const char    *color;
+
+	if (!sb_file_read(&sb_ram.meminfo, sb_ram.buf, sizeof(sb_ram.buf), routine))
+		return SB_FALSE;
+
+	if (!sb_ram_parse()) {
+		sb_print_error(routine, "Failed to get memory amounts");
+		return SB_FALSE;
+	}
+
+	/* MemAvailable counts the page cache and other memory that the kernel can reclaim, which
+	 * MemFree leaves out. Kernels before 3.14 don't have it, so estimate it for them. */
+	avail = values[SB_RAM_KEY_MEM_AVAILABLE];
+	if (avail == 0)
+		avail = values[SB_RAM_KEY_MEM_FREE] + values[SB_RAM_KEY_BUFFERS] + values[SB_RAM_KEY_CACHED];
+	if (avail > values[SB_RAM_KEY_MEM_TOTAL])
+		avail = values[SB_RAM_KEY_MEM_TOTAL];
+
+	perc = sb_normalize_perc(((values[SB_RAM_KEY_MEM_TOTAL] - avail) * 100) / values[SB_RAM_KEY_MEM_TOTAL]);
+	if (perc < 75) {
+		color = routine->colors.normal;
+	} else if (perc < 90) {
+		color = routine->colors.warning;
+	} else {
+		color = routine->colors.error;
+	}
+
+	value_f = sb_calc_magnitude(avail * 1024, &value_unit);
+	total_f = sb_calc_magnitude(values[SB_RAM_KEY_MEM_TOTAL] * 1024, &total_unit);
+	len = snprintf(output, sizeof(output), "%.1f%c free/%.1f%c", value_f, value_unit, total_f, total_unit);
+
+	if ((ram_details & SB_RAM_SWAP) && values[SB_RAM_KEY_SWAP_TOTAL] > 0 && len < sizeof(output)) {
+		swap    = values[SB_RAM_KEY_SWAP_TOTAL] - values[SB_RAM_KEY_SWAP_FREE];
+		value_f = sb_calc_magnitude(swap * 1024, &value_unit);
+		len += snprintf(output + len, sizeof(output) - len, " swap %.1f%c", value_f, value_unit);
+	}
+
+	if ((ram_details & SB_RAM_DIRTY) && len < sizeof(output)) {
+		value_f = sb_calc_magnitude((values[SB_RAM_KEY_DIRTY] + values[SB_RAM_KEY_WRITEBACK]) * 1024, &value_unit);
+		len += snprintf(output + len, sizeof(output) - len, " dirty %.1f%c", value_f, value_unit);
+	}
+
+	if ((ram_details & SB_RAM_HUGEPAGES) && values[SB_RAM_KEY_HUGEPAGES_TOTAL] > 0 && len < sizeof(output)) {
+		len += snprintf(output + len, sizeof(output) - len, " huge %lu/%lu",
+				values[SB_RAM_KEY_HUGEPAGES_FREE], values[SB_RAM_KEY_HUGEPAGES_TOTAL]);
+	}
+
+	sb_publish(routine, color, "%s", output);
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_ram_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_RAM
+	sb_file_close(&sb_ram.meminfo);
+#else
+	(void)ram_details;
+#endif
+	(void)routine;
+}
+
+
+/* --- TODO ROUTINE --- */
+#ifdef BUILD_TODO
+static struct {
+	char        path[512];
+	const char *name; /* Name of the file within its directory. */
+	int         fd;   /* inotify instance. */
+	int         dir;  /* Watch descriptor for the file's directory. */
+	int         file; /* Watch descriptor for the file itself. */
+} sb_todo;
+
+/* Events to watch for on the directory (for the TODO file's name) and on the file itself. */
+#define SB_TODO_DIR_EVENTS  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define SB_TODO_FILE_EVENTS (IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+static int sb_todo_count_blanks(const char *line, SB_BOOL *isempty)
+{
+	int i = 0;
+
+	*isempty = SB_FALSE;
+
+	switch (*line) {
+		case '\t':
+		case ' ' :
+			while (line[i] && isblank(line[i]) != 0) {
+				i++;
+			}
+			if (!isgraph(line[i]))
+				*isempty = SB_TRUE;
+			return i;
+		case '\n':
+			*isempty = SB_TRUE;
+	}
+
+	return 0;
+}
+#endif
+
+static SB_BOOL sb_todo_init(sb_routine_t *routine)
+{
+	/* Instead of reading the file every interval, we're going to have inotify tell us when it
+	 * changes. Editors often save by writing a new file and renaming it over the old one,
+	 * which the watch on the file itself would miss, so we also watch the directory for new
+	 * files with the same name. The watch on the file catches changes when the path is a
+	 * symlink into some other directory. */
+#ifdef BUILD_TODO
+	char *slash;
+
+	snprintf(sb_todo.path, sizeof(sb_todo.path), "%s/%s", getenv("HOME"), todo_path);
+	sb_debug(__func__, "init: using %s", sb_todo.path);
+
+	sb_todo.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (sb_todo.fd < 0) {
+		sb_print_error(routine, "Failed to create inotify instance");
+		return SB_FALSE;
+	}
+
+	/* Watch the directory that the file is in. */
+	slash        = strrchr(sb_todo.path, '/');
+	sb_todo.name = slash + 1;
+	*slash       = '\0';
+	sb_todo.dir  = inotify_add_watch(sb_todo.fd, sb_todo.path, SB_TODO_DIR_EVENTS);
+	*slash       = '/';
+	if (sb_todo.dir < 0) {
+		sb_print_error(routine, "Failed to watch directory of %s", sb_todo.path);
+		close(sb_todo.fd);
+		sb_todo.fd = -1;
+		return SB_FALSE;
+	}
+
+	sb_todo.file = inotify_add_watch(sb_todo.fd, sb_todo.path, SB_TODO_FILE_EVENTS);
+	sb_debug(__func__, "init: watching %s", sb_todo.path);
+
+	if (!sb_watch_add(routine, sb_todo.fd, POLLIN)) {
+		close(sb_todo.fd);
+		sb_todo.fd = -1;
+		return SB_FALSE;
+	}
+
+	return SB_TRUE;
+#else
+	(void)todo_path;
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_todo_update(sb_routine_t *routine)
+{
+	/* We're going to read in the first two lines of the user's personal TODO list
+ 	 * and print them based on a few rules:
+	 * 1. If the file is empty, print "Finished".
+	 * 2. If the second line is empty, only print the first line.
+	 * 3. If the second line is indented over from the first, then it is a child
+	 *    task of the first. Print "line1 -> line2".
+	 * 4. If the second line is not indented, both tasks are equal. Print "line1 | line2".
+	 */
+#ifdef BUILD_TODO
+	FILE       *fd;
+	const char *separator;
+	int         i;
+	struct {
+		char        line[512];
+		const char *ptr;
+		SB_BOOL     isempty;
+	} line[2] = {0};
+
+	fd = fopen(sb_todo.path, "r");
+	if (fd == NULL && errno == ENOENT) {
+		/* The file was deleted, or an editor is in the middle of replacing it. Show it as
+		 * empty until it is back. */
+		sb_debug(__func__, "%s is missing", sb_todo.path);
+		sb_publish(routine, routine->colors.normal, "Finished");
+		return SB_TRUE;
+	} else if (fd == NULL) {
+		sb_print_error(routine, "Failed to open %s", sb_todo.path);
+		return SB_FALSE;
+	}
+
+	if (fgets(line[0].line, sizeof(line[0].line), fd) == NULL) {
+		line[0].isempty = SB_TRUE;
+		line[1].isempty = SB_TRUE;
+	} else if (fgets(line[1].line, sizeof(line[1].line), fd) == NULL) {
+		line[1].isempty = SB_TRUE;
+	}
+
+	if (fclose(fd) != 0) {
+		sb_print_error(routine, "Failed to close %s", sb_todo.path);
+		return SB_FALSE;
+	}
+
+	if (line[0].isempty || line[1].isempty) {
+		separator = "";
+	} else if (isblank(*line[1].line)) {
+		separator = " -> ";
+	} else {
+		separator = " | ";
+	}
+
+	for (i=0; i<2; i++) {
+		/* reset pointer to beginning of line */
+		line[i].ptr = line[i].line;
+
+		/* advance line pointer until it hits the first non-blank character */
+		if (!line[i].isempty) {
+			line[i].line[strcspn(line[i].line, "\n")] = '\0'; /* don't print newline character */
+			line[i].ptr += sb_todo_count_blanks(line[i].line, &line[i].isempty);
+		}
+	}
+
+	if (line[0].isempty && line[1].isempty) {
+		sb_publish(routine, routine->colors.normal, "Finished");
+	} else {
+		sb_publish(routine, routine->colors.normal, "%s%s%s", line[0].ptr, separator, line[1].ptr);
+	}
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_todo_event(sb_routine_t *routine, int fd, short revents)
+{
+	/* The inotify instance has events. Read all of them, and if any of them are for the TODO
+	 * file being saved, replaced, moved, or deleted, read the file again. */
+#ifdef BUILD_TODO
+	char                        buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t                     len;
+	char                       *ptr;
+	SB_BOOL                     changed = SB_FALSE;
+	SB_BOOL                     moved   = SB_FALSE;
+
+	(void)revents;
+	while (1) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+			if (event->wd == sb_todo.file) {
+				/* This includes IN_IGNORED, when the watch went away with a deleted file. */
+				changed = SB_TRUE;
+				if (event->mask & IN_MOVE_SELF)
+					moved = SB_TRUE;
+			} else if (event->wd == sb_todo.dir && event->len > 0 && strcmp(event->name, sb_todo.name) == 0) {
+				changed = SB_TRUE;
+			}
+		}
+	}
+
+	if (len < 0 && errno != EAGAIN) {
+		sb_print_error(routine, "Failed to read inotify events");
+		return SB_FALSE;
+	}
+
+	if (!changed)
+		return SB_TRUE;
+
+	/* If the file was replaced or deleted, the old watch went away with it. If it was moved, the
+	 * old watch would follow it to its new name, so drop it. Then watch whatever file is at the
+	 * path now, if there is one. */
+	sb_debug(__func__, "%s changed", sb_todo.path);
+	if (moved)
+		inotify_rm_watch(sb_todo.fd, sb_todo.file);
+	sb_todo.file = inotify_add_watch(sb_todo.fd, sb_todo.path, SB_TODO_FILE_EVENTS);
+
+	return sb_todo_update(routine);
+#else
+	(void)routine;
+	(void)fd;
+	(void)revents;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_todo_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_TODO
+	if (sb_todo.fd >= 0)
+		close(sb_todo.fd);
+	sb_todo.fd = -1;
+#endif
+	(void)routine;
+}
+
+
+/* --- VOLUME ROUTINE --- */
+#ifdef BUILD_VOLUME
+static struct {
+	snd_mixer_t      *mixer;
 	snd_mixer_elem_t *snd_elem;
 	long              min;
 	long              max;
-	int               mute = 0;
-	long              decibels;
-	long              perc;
+	struct pollfd     fds[4];   /* Poll descriptors of the mixer. */
+	int               num_fds;
+	SB_BOOL           ok;       /* SB_FALSE if the element callback ran into an error. */
+} sb_volume;
+
+static SB_BOOL sb_volume_get_snd_elem(snd_mixer_t **mixer, snd_mixer_elem_t **snd_elem, sb_routine_t *routine)
+{
+	static const char    *card   = "hw:0";
+	snd_mixer_selem_id_t *snd_id = NULL;
+	static const int      index  = 0;
+	static const char    *name   = "Master";
+
+	*snd_elem = NULL;
+	*mixer    = NULL;
+
+	/* open and load mixer */
+	if (snd_mixer_open(mixer, 0) < 0) {
+		sb_print_error(routine, "Failed to open mixer");
+	} else if (snd_mixer_attach(*mixer, card) < 0) {
+		sb_print_error(routine, "Failed to attach mixer");
+	} else if (snd_mixer_selem_register(*mixer, NULL, NULL) < 0) {
+		sb_print_error(routine, "Failed to register mixer");
+	} else if (snd_mixer_load(*mixer) < 0) {
+		sb_print_error(routine, "Failed to load mixer");
+
+	/* get id */
+	} else if (snd_mixer_selem_id_malloc(&snd_id) != 0) {
+		sb_print_error(routine, "Failed to allocate snd_id");
+
+	/* get element */
+	} else {
+		sb_debug(__func__, "init: opened mixer");
+		sb_debug(__func__, "init: opened id");
+
+		snd_mixer_selem_id_set_index(snd_id, index);
+		snd_mixer_selem_id_set_name(snd_id, name);
+		*snd_elem = snd_mixer_find_selem(*mixer, snd_id);
+		snd_mixer_selem_id_free(snd_id);
+		if (*snd_elem == NULL) {
+			sb_print_error(routine, "Failed to find element");
+		} else if (snd_mixer_selem_has_playback_volume(*snd_elem) == 0) {
+			sb_print_error(routine, "Element does not have playback volume");
+		} else {
+			return SB_TRUE;
+		}
+	}
+
+	return SB_FALSE;
+}
+
+static int sb_volume_elem_cb(snd_mixer_elem_t *snd_elem, unsigned int mask)
+{
+	/* ALSA calls this from snd_mixer_handle_events when the element changes. */
+	sb_routine_t *routine = snd_mixer_elem_get_callback_private(snd_elem);
+
+	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+		sb_print_error(routine, "Element was removed");
+		sb_volume.snd_elem = NULL;
+		sb_volume.ok       = SB_FALSE;
+	} else if (mask & SND_CTL_EVENT_MASK_VALUE) {
+		sb_debug(__func__, "element changed");
+		if (!routine->update(routine))
+			sb_volume.ok = SB_FALSE;
+	}
+
+	return 0;
+}
+#endif
+
+static SB_BOOL sb_volume_init(sb_routine_t *routine)
+{
+	/* Rather than asking the mixer for the volume every interval, we're going to wait on the
+	 * mixer's poll descriptors and let ALSA tell us when the element changes. */
+#ifdef BUILD_VOLUME
+	int i;
+
+	sb_volume.num_fds = 0;
+	sb_volume.ok      = SB_TRUE;
+
+	sb_debug(__func__, "init: open element");
+	if (!sb_volume_get_snd_elem(&sb_volume.mixer, &sb_volume.snd_elem, routine))
+		return SB_FALSE;
+
+	if (snd_mixer_selem_get_playback_dB_range(sb_volume.snd_elem, &sb_volume.min, &sb_volume.max) != 0) {
+		sb_print_error(routine, "Failed to get decibels range");
+		return SB_FALSE;
+	}
+	sb_debug(__func__, "init: opened element");
+
+	snd_mixer_elem_set_callback(sb_volume.snd_elem, sb_volume_elem_cb);
+	snd_mixer_elem_set_callback_private(sb_volume.snd_elem, routine);
+
+	sb_volume.num_fds = snd_mixer_poll_descriptors_count(sb_volume.mixer);
+	if (sb_volume.num_fds <= 0 || sb_volume.num_fds > (int)(sizeof(sb_volume.fds) / sizeof(*sb_volume.fds))) {
+		sb_print_error(routine, "Unexpected number of poll descriptors: %d", sb_volume.num_fds);
+		sb_volume.num_fds = 0;
+		return SB_FALSE;
+	}
+
+	sb_volume.num_fds = snd_mixer_poll_descriptors(sb_volume.mixer, sb_volume.fds, sb_volume.num_fds);
+	for (i=0; i<sb_volume.num_fds; i++) {
+		if (!sb_watch_add(routine, sb_volume.fds[i].fd, sb_volume.fds[i].events))
+			return SB_FALSE;
+	}
+
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_volume_update(sb_routine_t *routine)
+{
+#ifdef BUILD_VOLUME
+	int         mute = 0;
+	long        decibels;
+	long        perc;
+	const char *color;
+
+	if (snd_mixer_selem_get_playback_switch(sb_volume.snd_elem, SND_MIXER_SCHN_MONO, &mute) != 0) {
+		sb_print_error(routine, "Failed to get mute state");
+		return SB_FALSE;
+	} else if (mute == 0) {
+		sb_debug(__func__, "sound is muted");
+		sb_publish(routine, routine->colors.normal, "mute");
+	} else if (snd_mixer_selem_get_playback_dB(sb_volume.snd_elem, SND_MIXER_SCHN_MONO, &decibels) != 0) {
+		sb_print_error(routine, "Failed to get decibels");
+		return SB_FALSE;
+	} else {
+		sb_debug(__func__, "current decibels: %ld", decibels);
+		perc = sb_normalize_perc((decibels-sb_volume.min)*100/(sb_volume.max-sb_volume.min));
+		perc = rint((float)perc / 10) * 10; /* round to nearest ten */
+		if (perc < 80) {
+			color = routine->colors.normal;
+		} else if (perc < 100) {
+			color = routine->colors.warning;
+		} else {
+			color = routine->colors.error;
+		}
+
+		sb_publish(routine, color, "Vol %ld%%", perc);
+	}
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_volume_event(sb_routine_t *routine, int fd, short revents)
+{
+	/* One of the mixer's poll descriptors is ready. Let ALSA work out what that means, and
+	 * have it process the events, which runs the element callback if the volume changed. */
+#ifdef BUILD_VOLUME
+	unsigned short events = 0;
+	int            i;
+
+	for (i=0; i<sb_volume.num_fds; i++)
+		sb_volume.fds[i].revents = sb_volume.fds[i].fd == fd ? revents : 0;
+
+	if (snd_mixer_poll_descriptors_revents(sb_volume.mixer, sb_volume.fds, sb_volume.num_fds, &events) < 0) {
+		sb_print_error(routine, "Failed to get mixer events");
+		return SB_FALSE;
+	} else if (events & (POLLERR | POLLHUP | POLLNVAL)) {
+		sb_print_error(routine, "Lost connection to mixer");
+		return SB_FALSE;
+	} else if ((events & POLLIN) && snd_mixer_handle_events(sb_volume.mixer) < 0) {
+		sb_print_error(routine, "Failed to handle mixer events");
+		return SB_FALSE;
+	}
+
+	return sb_volume.ok;
+#else
+	(void)routine;
+	(void)fd;
+	(void)revents;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_volume_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_VOLUME
+	if (sb_volume.mixer != NULL) {
+		snd_mixer_close(sb_volume.mixer);
+		sb_volume.mixer = NULL;
+	}
+#endif
+	(void)routine;
+}
+
+
+/* --- WEATHER ROUTINE --- */
+#ifdef BUILD_WEATHER
+/* Where to look up a zip code's coordinates, and then the forecast URL for those coordinates.
+ * These can be defined at build time to test against a local server. */
+#ifndef SB_WEATHER_ZIP_URL
+  #define SB_WEATHER_ZIP_URL    "https://api.promaptools.com/service/us/zip-lat-lng/get/?zip=%s&key=17o8dysaCDrgv1c"
+#endif
+#ifndef SB_WEATHER_POINTS_URL
+  #define SB_WEATHER_POINTS_URL "https://api.weather.gov/points/%.4f,%.4f"
+#endif
+
+/* Documents that are fetched every update. */
+enum sb_weather_doc_e {
+	SB_WEATHER_HOURLY = 0,
+	SB_WEATHER_DAILY     ,
+	SB_WEATHER_DOCS      ,
+};
+
+/* What we know about the last good response for a document, so that we can ask the server to
+ * only send it again if it has changed. */
+struct sb_weather_doc {
+	char etag[128];    /* ETag header, or empty. */
+	char modified[64]; /* Last-Modified header, or empty. */
+	int  values[2];    /* Values that were parsed out of the response. */
+};
+
+/* Value to pull out of a JSON document, like "properties.periods[0].temperature". */
+struct sb_json_query {
+	const char *path;
+	char        value[64]; /* Text of the value, without quotes for strings. */
+	SB_BOOL     found;
+};
+
+#define SB_JSON_DEPTH 16
+
+/* Extractor that reads a JSON document as it comes in, one chunk at a time, and keeps only
+ * the values at the paths that were asked for. It doesn't build a tree and doesn't allocate
+ * anything. It is also not a validator: a document that is not valid JSON can give odd
+ * results, but never more than the values that were asked for. */
+typedef struct sb_json {
+	struct sb_json_query *queries;
+	int                   num_queries;
+	int                   num_found;
+	enum {
+		SB_JSON_SCAN = 0, /* between tokens */
+		SB_JSON_STRING  ,
+		SB_JSON_ESCAPE  , /* after a backslash in a string */
+		SB_JSON_UNICODE , /* in the hex digits of a \u escape */
+		SB_JSON_LITERAL , /* in a number, true, false, or null */
+	} state;
+	int                   unicode; /* Hex digits left in the \u escape. */
+	SB_BOOL               want_key; /* SB_TRUE if the next string is an object key. */
+	SB_BOOL               error;
+	int                   depth;
+	struct {
+		SB_BOOL array; /* SB_TRUE for an array, SB_FALSE for an object. */
+		long    index; /* Index of the current element, for arrays. */
+		size_t  base;  /* Length of the path to the container itself. */
+	} stack[SB_JSON_DEPTH];
+	char                  path[256]; /* Path to the current value. */
+	size_t                path_len;
+	char                  token[64]; /* String or literal being read, cut short if it is longer. */
+	size_t                token_len;
+} sb_json_t;
+
+static void sb_json_init(sb_json_t *json, struct sb_json_query queries[], int num_queries)
+{
+	int i;
+
+	memset(json, 0, sizeof(*json));
+	json->queries     = queries;
+	json->num_queries = num_queries;
+	for (i=0; i<num_queries; i++) {
+		queries[i].value[0] = '\0';
+		queries[i].found    = SB_FALSE;
+	}
+}
+
+static void sb_json_path_add(sb_json_t *json, const char *format, ...)
+{
+	/* This will add a segment to the end of the path. A path that doesn't fit is cut short,
+	 * which is longer than any query and so can't match one. */
+	va_list ap;
+	int     len;
+
+	va_start(ap, format);
+	len = vsnprintf(json->path + json->path_len, sizeof(json->path) - json->path_len, format, ap);
+	va_end(ap);
+
+	if (len > 0)
+		json->path_len += (size_t)len;
+	if (json->path_len >= sizeof(json->path))
+		json->path_len = sizeof(json->path) - 1;
+}
+
+static void sb_json_path_reset(sb_json_t *json)
+{
+	/* Go back to the path of the innermost container. */
+	json->path_len               = json->stack[json->depth-1].base;
+	json->path[json->path_len]   = '\0';
+}
+
+static void sb_json_value(sb_json_t *json)
+{
+	/* A scalar value has been read. Keep it if its path is one that was asked for. */
+	int i;
+
+	json->token[json->token_len] = '\0';
+	for (i=0; i<json->num_queries; i++) {
+		if (!json->queries[i].found && strcmp(json->path, json->queries[i].path) == 0) {
+			memcpy(json->queries[i].value, json->token, json->token_len + 1);
+			json->queries[i].found = SB_TRUE;
+			json->num_found++;
+		}
+	}
+}
+
+static void sb_json_add(sb_json_t *json, char c)
+{
+	if (json->token_len < sizeof(json->token) - 1)
+		json->token[json->token_len++] = c;
+}
+
+static void sb_json_scan(sb_json_t *json, char c)
+{
+	/* Handle a character between tokens. */
+	switch (c) {
+		case '{':
+		case '[':
+			if (json->depth == SB_JSON_DEPTH) {
+				json->error = SB_TRUE;
+				return;
+			}
+			json->stack[json->depth].array = c == '[' ? SB_TRUE : SB_FALSE;
+			json->stack[json->depth].index = 0;
+			json->stack[json->depth].base  = json->path_len;
+			json->depth++;
+			json->want_key = c == '{' ? SB_TRUE : SB_FALSE;
+			if (c == '[')
+				sb_json_path_add(json, "[0]");
+			break;
+		case '}':
+		case ']':
+			if (json->depth == 0) {
+				json->error = SB_TRUE;
+				return;
+			}
+			sb_json_path_reset(json);
+			json->depth--;
+			json->want_key = SB_FALSE;
+			break;
+		case ',':
+			if (json->depth == 0) {
+				json->error = SB_TRUE;
+				return;
+			}
+			if (json->stack[json->depth-1].array) {
+				sb_json_path_reset(json);
+				sb_json_path_add(json, "[%ld]", ++json->stack[json->depth-1].index);
+			} else {
+				json->want_key = SB_TRUE;
+			}
+			break;
+		case '"':
+			json->token_len = 0;
+			json->state     = SB_JSON_STRING;
+			break;
+		case ' ' :
+		case '\t':
+		case '\r':
+		case '\n':
+		case ':' :
+			break;
+		default:
+			json->token_len = 0;
+			json->state     = SB_JSON_LITERAL;
+			sb_json_add(json, c);
+	}
+}
+
+static void sb_json_feed(sb_json_t *json, const char *data, size_t len)
+{
+	/* This will read the next chunk of the document. Once every query has been found, the
+	 * rest of the document is skipped. */
+	size_t i;
+	char   c;
+
+	for (i=0; i<len && !json->error && json->num_found < json->num_queries; i++) {
+		c = data[i];
+		switch (json->state) {
+			case SB_JSON_STRING:
+				if (c == '\\') {
+					json->state = SB_JSON_ESCAPE;
+				} else if (c != '"') {
+					sb_json_add(json, c);
+				} else if (json->want_key && json->depth > 0) {
+					/* This was the key of an object member, so it is the last part of the
+					 * path to the member's value. */
+					json->token[json->token_len] = '\0';
+					json->state                  = SB_JSON_SCAN;
+					json->want_key               = SB_FALSE;
+					sb_json_path_reset(json);
+					sb_json_path_add(json, json->path_len > 0 ? ".%s" : "%s", json->token);
+				} else {
+					json->state = SB_JSON_SCAN;
+					sb_json_value(json);
+				}
+				break;
+			case SB_JSON_ESCAPE:
+				json->state = SB_JSON_STRING;
+				switch (c) {
+					case 'n': sb_json_add(json, '\n'); break;
+					case 't': sb_json_add(json, '\t'); break;
+					case 'r': sb_json_add(json, '\r'); break;
+					case 'b': sb_json_add(json, '\b'); break;
+					case 'f': sb_json_add(json, '\f'); break;
+					case 'u':
+						/* We don't need anything outside of ASCII, so we don't decode these. */
+						sb_json_add(json, '?');
+						json->unicode = 4;
+						json->state   = SB_JSON_UNICODE;
+						break;
+					default : sb_json_add(json, c);
+				}
+				break;
+			case SB_JSON_UNICODE:
+				if (--json->unicode == 0)
+					json->state = SB_JSON_STRING;
+				break;
+			case SB_JSON_LITERAL:
+				if (c != ',' && c != ']' && c != '}' && !isspace((unsigned char)c)) {
+					sb_json_add(json, c);
+					break;
+				}
+				json->state = SB_JSON_SCAN;
+				sb_json_value(json);
+				sb_json_scan(json, c);
+				break;
+			case SB_JSON_SCAN:
+				sb_json_scan(json, c);
+				break;
+		}
+	}
+}
+
+static SB_BOOL sb_json_int(const struct sb_json_query *query, int *value)
+{
+	/* This will get a query's value as a whole number. Returns SB_FALSE if the value wasn't
+	 * found or isn't a number. */
+	char   *end;
+	double  num;
+
+	if (!query->found || query->value[0] == '\0')
+		return SB_FALSE;
+
+	num = strtod(query->value, &end);
+	if (*end != '\0' || !(num > -1000000 && num < 1000000))
+		return SB_FALSE;
+
+	*value = (int)(num < 0 ? num - 0.5 : num + 0.5);
+	return SB_TRUE;
+}
+
+/* Values that are read out of the hourly and daily forecasts. The current temperature is in the
+ * first period of the hourly forecast. Which periods of the daily forecast hold tomorrow's high
+ * and low depends on the name of the first one. */
+static const char *sb_weather_paths[SB_WEATHER_DOCS][6] = {
+	{ "properties.periods[0].temperature" },
+	{
+		"properties.periods[0].name",
+		"properties.periods[1].temperature",
+		"properties.periods[2].temperature",
+		"properties.periods[3].temperature",
+		"properties.periods[4].temperature",
+	},
+};
+
+/* One of the two requests that are made every update. During init, the first one is also used
+ * to look up the forecast URLs. */
+struct sb_weather_req {
+	CURL              *curl;
+	struct curl_slist *headers;      /* Request headers, if this request is conditional. */
+	char              *response;
+	size_t             len;
+	long               code;         /* HTTP status of the last request. */
+	CURLcode           result;       /* Result of the last transfer. */
+	SB_BOOL            active;       /* SB_TRUE while the request is in the multi handle. */
+	char               etag[128];    /* ETag header of the last response. */
+	char               modified[64]; /* Last-Modified header of the last response. */
+	char               errbuf[CURL_ERROR_SIZE];
+	SB_BOOL            stream;       /* SB_TRUE if the response is read into json instead of
+	                                    being kept whole. */
+	sb_json_t          json;
+	struct sb_json_query queries[6];
+};
+
+/* What the requests in flight are for. Looking up the forecast URLs takes two requests, one
+ * after the other, on the hourly request's handle. */
+enum sb_weather_stage_e {
+	SB_WEATHER_IDLE = 0,    /* Nothing is running. */
+	SB_WEATHER_COORDINATES, /* Looking up the coordinates of the zip code. */
+	SB_WEATHER_POINTS,      /* Looking up the forecast URL for the coordinates. */
+	SB_WEATHER_FORECASTS,   /* Getting both forecasts. */
+};
+
+struct sb_weather_t {
+	CURLM                  *multi;
+	enum sb_weather_stage_e stage;
+	SB_BOOL                 fetch;      /* SB_TRUE to get the forecasts as soon as the URLs
+	                                       have been looked up, instead of at the next update. */
+	int                     timer;      /* timerfd for the timeouts that libcurl asks for. */
+	struct curl_slist      *headers;
+	char                    url[128];   /* Temporary URL during init, temperature URL during loop. */
+	char                    url2[128];  /* Empty during init, daily forecast URL during loop. */
+	struct sb_weather_req   reqs[SB_WEATHER_DOCS];
+	struct sb_weather_doc   docs[SB_WEATHER_DOCS];
+	char                    cache[512]; /* Path to the cache file, or empty if there is no home. */
+};
+
+static struct sb_weather_t sb_weather;
+
+static size_t sb_weather_curl_cb(char *buffer, size_t size, size_t num, void *thunk)
+{
+	struct sb_weather_req *req = thunk;
+	size_t                 buffer_len;
+	char                  *response;
+
+	buffer_len = size*num;
+	if (req->stream) {
+		sb_json_feed(&(req->json), buffer, buffer_len);
+		return buffer_len;
+	}
+
+	response = realloc(req->response, req->len + buffer_len + 1);
+	if (response == NULL)
+		return 0;
+	req->response = response;
+
+	memcpy(req->response+req->len, buffer, buffer_len);
+
+	req->len                += buffer_len;
+	req->response[req->len]  = '\0';
+
+	return buffer_len;
+}
+
+static size_t sb_weather_header_cb(char *buffer, size_t size, size_t num, void *thunk)
+{
+	/* This will save the validators of the response. The header lines are not NUL-terminated
+	 * and end in "\r\n". */
+	struct sb_weather_req *req  = thunk;
+	size_t                 len  = size*num;
+	char                  *dest = NULL;
+	size_t                 dest_size;
+	size_t                 skip;
+
+	if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+		dest      = req->etag;
+		dest_size = sizeof(req->etag);
+		skip      = 5;
+	} else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+		dest      = req->modified;
+		dest_size = sizeof(req->modified);
+		skip      = 14;
+	} else {
+		return len;
+	}
+
+	while (skip < len && buffer[skip] == ' ')
+		skip++;
+	while (len > skip && (buffer[len-1] == '\r' || buffer[len-1] == '\n' || buffer[len-1] == ' '))
+		len--;
+
+	/* A value that doesn't fit is no use, so leave it out. */
+	if (len - skip < dest_size)
+		snprintf(dest, dest_size, "%.*s", (int)(len - skip), buffer + skip);
+
+	return size*num;
+}
+
+static void sb_weather_clear_response(struct sb_weather_req *req)
+{
+	free(req->response);
+
+	req->response = NULL;
+	req->len      = 0;
+	sb_leak_check(__func__);
+}
+
+static void sb_weather_prepare(struct sb_weather_req *req, const char *url, const char *paths[], struct sb_weather_doc *doc)
+{
+	/* This will set up req to get url. If paths is not NULL, only the values at those paths
+	 * are kept from the response. If doc is not NULL and we have validators for it, the
+	 * request only asks for the document if it has changed since the last good response. */
+	struct curl_slist *tmp;
+	char               header[160];
+	int                num = 0;
+
+	req->code        = 0;
+	req->etag[0]     = '\0';
+	req->modified[0] = '\0';
+	curl_easy_setopt(req->curl, CURLOPT_URL, url);
+
+	req->stream = paths != NULL ? SB_TRUE : SB_FALSE;
+	if (req->stream) {
+		for (num=0; num<(int)(sizeof(req->queries) / sizeof(*req->queries)) && paths[num] != NULL; num++)
+			req->queries[num].path = paths[num];
+		sb_json_init(&(req->json), req->queries, num);
+	}
+
+	if (doc == NULL || (doc->etag[0] == '\0' && doc->modified[0] == '\0'))
+		return;
+
+	req->headers = curl_slist_append(req->headers, "accept: application/json");
+	if (doc->etag[0] != '\0') {
+		snprintf(header, sizeof(header), "If-None-Match: %s", doc->etag);
+		tmp          = curl_slist_append(req->headers, header);
+		req->headers = tmp != NULL ? tmp : req->headers;
+	}
+	if (doc->modified[0] != '\0') {
+		snprintf(header, sizeof(header), "If-Modified-Since: %s", doc->modified);
+		tmp          = curl_slist_append(req->headers, header);
+		req->headers = tmp != NULL ? tmp : req->headers;
+	}
+	if (req->headers != NULL)
+		curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+}
+
+static SB_BOOL sb_weather_check(struct sb_weather_req *req, const char *data, SB_BOOL conditional, sb_routine_t *routine)
+{
+	/* This will check how the transfer went. If the request was conditional and the document
+	 * hasn't changed, req->code is set to 304 and there is no response. */
+	long  code;
+	char *type; /* this will get free'd during curl_easy_cleanup() */
+
+	if (req->headers != NULL) {
+		curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, sb_weather.headers);
+		curl_slist_free_all(req->headers);
+		req->headers = NULL;
+	}
+
+	if (req->result != CURLE_OK) {
+		sb_print_error(routine, "Failed to get %s: %s", data, curl_easy_strerror(req->result));
+		return SB_FALSE;
+	}
+
+	curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &code);
+	req->code = code;
+	if (code == 304 && conditional) {
+		sb_debug(__func__, "%s has not changed", data);
+		sb_weather_clear_response(req);
+		return SB_TRUE;
+	} else if (code != 200) {
+		sb_print_error(routine, "curl returned %ld for %s", code, data);
+		return SB_FALSE;
+	}
+
+	/* Check for content type equal to JSON or GeoJSON. */
+	curl_easy_getinfo(req->curl, CURLINFO_CONTENT_TYPE, &type);
+	if (type == NULL || (strcasecmp(type, "application/json") != 0 && strcasecmp(type, "application/geo+json") != 0)) {
+		sb_print_error(routine, "Mismatch content type (%s) for %s", type ? type : "none", data);
+		return SB_FALSE;
+	}
+
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_weather_start(struct sb_weather_req *req, sb_routine_t *routine)
+{
+	/* This will hand a prepared request to the multi handle. It runs from sb_weather_event. */
+	if (curl_multi_add_handle(sb_weather.multi, req->curl) != CURLM_OK) {
+		sb_print_error(routine, "Failed to start request");
+		return SB_FALSE;
+	}
+
+	req->active = SB_TRUE;
+	return SB_TRUE;
+}
+
+static void sb_weather_save_doc(struct sb_weather_req *req, struct sb_weather_doc *doc, int value0, int value1)
+{
+	/* Remember the validators of a response that was parsed, along with what was in it. */
+	memcpy(doc->etag, req->etag, sizeof(doc->etag));
+	memcpy(doc->modified, req->modified, sizeof(doc->modified));
+	doc->values[0] = value0;
+	doc->values[1] = value1;
+}
+
+static SB_BOOL sb_weather_read_forecast(struct sb_weather_t *info, int *low, int *high, sb_routine_t *routine)
+{
+	struct sb_weather_req *req = &(info->reqs[SB_WEATHER_DAILY]);
+	struct sb_weather_doc *doc = &(info->docs[SB_WEATHER_DAILY]);
+	const char            *name;
+	int                    i;
+
+	if (!sb_weather_check(req, "daily forecast", SB_TRUE, routine))
+		return SB_FALSE;
+
+	if (req->code == 304) {
+		*high = doc->values[0];
+		*low  = doc->values[1];
+		return SB_TRUE;
+	}
+
+	if (!req->queries[0].found) {
+		sb_print_error(routine, "Failed to find name of first forecast period");
+		return SB_FALSE;
+	}
+
+	/* We want to skip past the periods for Today/This Afternoon and Tonight and grab the next
+	 * two after that. queries[i] holds the temperature of period i. */
+	name = req->queries[0].value;
+	if (strcmp(name, "Overnight") == 0) {
+		i = 3;
+	} else if (strcmp(name, "Today") == 0 || strcmp(name, "This Afternoon") == 0) {
+		i = 2;
+	} else if (strcmp(name, "Tonight") == 0) {
+		i = 1;
+	} else {
+		sb_print_error(routine, "Error in forecast array");
+		sb_print_error(routine, "  Unknown value: %s", name);
+		return SB_FALSE;
+	}
+
+	if (!sb_json_int(&(req->queries[i]), high) || !sb_json_int(&(req->queries[i+1]), low)) {
+		sb_print_error(routine, "Failed to find forecast temperatures");
+		return SB_FALSE;
+	}
+
+	sb_weather_save_doc(req, doc, *high, *low);
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_weather_read_temperature(struct sb_weather_t *info, int *temp, sb_routine_t *routine)
+{
+	struct sb_weather_req *req = &(info->reqs[SB_WEATHER_HOURLY]);
+	struct sb_weather_doc *doc = &(info->docs[SB_WEATHER_HOURLY]);
+
+	if (!sb_weather_check(req, "temperature", SB_TRUE, routine))
+		return SB_FALSE;
+
+	if (req->code == 304) {
+		*temp = doc->values[0];
+		return SB_TRUE;
+	}
+
+	if (!sb_json_int(&(req->queries[0]), temp)) {
+		sb_print_error(routine, "Failed to find current temperature");
+		return SB_FALSE;
+	}
+
+	sb_weather_save_doc(req, doc, *temp, 0);
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_weather_get_temperature_url(struct sb_weather_t *info, sb_routine_t *routine)
+{
+	struct sb_weather_req *req = &(info->reqs[SB_WEATHER_HOURLY]);
+	cJSON                 *json;
+	cJSON                 *props;
+	cJSON                 *url;
+
+	sb_debug(__func__, "init: getting temperature URL info");
+	if (!sb_weather_check(req, "forecast url", SB_FALSE, routine))
+		return SB_FALSE;
+
+	json = cJSON_Parse(req->response);
+	if (json == NULL) {
+		sb_print_error(routine, "Failed to parse properties response");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+	sb_debug(__func__, "init: read JSON");
+
+	props = cJSON_GetObjectItem(json, "properties");
+	if (props == NULL) {
+		sb_print_error(routine, "Failed to find \"properties\" node");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+	sb_debug(__func__, "init: found \"properties\" node");
+
+	url = cJSON_GetObjectItem(props, "forecast");
+	if (!cJSON_IsString(url)) {
+		sb_print_error(routine, "Failed to find \"forecast\" node");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+	sb_debug(__func__, "init: found \"forecast\" node");
+
+	/* Store daily forecast URL. */
+	strncpy(info->url2, url->valuestring, sizeof(info->url2)-1);
+	sb_debug(__func__, "init: stored daily forecast URL");
+
+	/* Store hourly temperature URL. */
+	strncpy(info->url, info->url2, sizeof(info->url)-1);
+	strncat(info->url, "/hourly", sizeof(info->url)-strlen(info->url)-1);
+	sb_debug(__func__, "stored hourly temperature URL");
+
+	cJSON_Delete(json);
+	sb_weather_clear_response(req);
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_weather_get_coordinates(struct sb_weather_t *info, sb_routine_t *routine)
+{
+ 	/* A successful response will look something like this:
+	 * {"status":1,"output":[{"zip":"90210","latitude":"34.103131","longitude":"-118.416253"}]}
+	 * An unsuccessful response will look something like this:
+	 * {"status":-3,"msg":"No results found"}
+	 */
+	struct sb_weather_req *req = &(info->reqs[SB_WEATHER_HOURLY]);
+	cJSON                 *json;
+	cJSON                 *tmp;
+	cJSON                 *num;
+	float                  lat;
+	float                  lon;
+
+	sb_debug(__func__, "init: getting coordinates info");
+	if (!sb_weather_check(req, "coordinates", SB_FALSE, routine))
+		return SB_FALSE;
+
+	json = cJSON_Parse(req->response);
+	if (json == NULL) {
+		sb_print_error(routine, "Failed to parse zip code response");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+	sb_debug(__func__, "init: opened JSON");
+
+	/* Check that we don't have an error status code. */
+	tmp = cJSON_GetObjectItem(json, "status");
+	if (!cJSON_IsNumber(tmp) || tmp->valueint != 1) {
+		sb_print_error(routine, "Response returned code %d", cJSON_IsNumber(tmp) ? tmp->valueint : 0);
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+
+	tmp = cJSON_GetObjectItem(json, "output");
+	tmp = cJSON_GetArrayItem(tmp, 0);
+	if (tmp == NULL) {
+		sb_print_error(routine, "Failed to find \"output\" node");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	} else {
+		sb_debug(__func__, "init: found \"output\" node");
+	}
+
+	num = cJSON_GetObjectItem(tmp, "latitude");
+	if (!cJSON_IsString(num)) {
+		sb_print_error(routine, "Failed to find \"latitude\" node");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+	lat = atof(num->valuestring);
+	sb_debug(__func__, "init: using latitude %f", lat);
+
+	num = cJSON_GetObjectItem(tmp, "longitude");
+	if (!cJSON_IsString(num)) {
+		sb_print_error(routine, "Failed to find \"longitude\" node");
+		cJSON_Delete(json);
+		return SB_FALSE;
+	}
+	lon = atof(num->valuestring);
+	sb_debug(__func__, "init: using longitude %f", lon);
+
+	/* Write coordinates into next url, which is for getting the zone and identifiers of the area. */
+	snprintf(info->url, sizeof(info->url)-1, SB_WEATHER_POINTS_URL, lat, lon);
+	sb_weather_prepare(req, info->url, NULL, NULL);
+	sb_debug(__func__, "init: prepared next URL");
+
+	cJSON_Delete(json);
+	sb_weather_clear_response(req);
+	return SB_TRUE;
+}
+
+static int sb_weather_socket_cb(CURL *curl, curl_socket_t fd, int what, void *thunk, void *socketp)
+{
+	/* libcurl calls this to tell us which of its sockets to watch, and for what. */
+	sb_routine_t *routine = thunk;
+	short         events  = 0;
+
+	(void)curl;
+	(void)socketp;
+
+	sb_watch_remove(routine, fd);
+	if (what == CURL_POLL_REMOVE)
+		return 0;
+
+	if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)
+		events |= POLLIN;
+	if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT)
+		events |= POLLOUT;
+
+	return sb_watch_add(routine, fd, events) ? 0 : -1;
+}
+
+static int sb_weather_timer_cb(CURLM *multi, long timeout_ms, void *thunk)
+{
+	/* libcurl calls this when it wants to be run after timeout_ms milliseconds, or never if
+	 * timeout_ms is -1. A timeout of 0 means right away, which the timerfd does as soon as we
+	 * get back to waiting. */
+	struct sb_weather_t *info = thunk;
+	struct itimerspec    its;
+
+	(void)multi;
+
+	memset(&its, 0, sizeof(its));
+	if (timeout_ms == 0) {
+		its.it_value.tv_nsec = 1;
+	} else if (timeout_ms > 0) {
+		its.it_value.tv_sec  = timeout_ms / 1000;
+		its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+	}
+
+	return timerfd_settime(info->timer, 0, &its, NULL) == 0 ? 0 : -1;
+}
+
+static SB_BOOL sb_weather_init_curl(struct sb_weather_t *info, sb_routine_t *routine)
+{
+	/* Both requests that are made every update go through one multi handle, so that they can
+	 * run at the same time (on one HTTP/2 connection, if the server supports it). Instead of
+	 * blocking until they are done, the routine watches libcurl's sockets and its timer and
+	 * lets libcurl do some work whenever one of them is ready. */
+	struct sb_weather_req *req;
+	int                    i;
+
+	sb_debug(__func__, "init: intializing libcurl objects");
+	memset(info, 0, sizeof(*info));
+	info->timer = -1;
+
+	info->headers = curl_slist_append(NULL, "accept: application/json");
+	sb_debug(__func__, "init: set header");
+
+	for (i=0; i<SB_WEATHER_DOCS; i++) {
+		req       = &(info->reqs[i]);
+		req->curl = curl_easy_init();
+		if (req->curl == NULL) {
+			sb_print_error(routine, "Failed to initialize curl handle");
+			return SB_FALSE;
+		}
+
+		curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, info->headers);
+		curl_easy_setopt(req->curl, CURLOPT_ERRORBUFFER, req->errbuf);
+		curl_easy_setopt(req->curl, CURLOPT_USERAGENT, "curl/7.9.7+");
+		curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, sb_weather_curl_cb);
+		curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+		curl_easy_setopt(req->curl, CURLOPT_HEADERFUNCTION, sb_weather_header_cb);
+		curl_easy_setopt(req->curl, CURLOPT_HEADERDATA, req);
+
+		/* Don't let a server that stops answering hold the routine up forever. */
+		curl_easy_setopt(req->curl, CURLOPT_TIMEOUT, 30L);
+
+		/* Wait for the other request's connection instead of opening a second one, in case
+		 * both requests can share it. */
+		curl_easy_setopt(req->curl, CURLOPT_PIPEWAIT, 1L);
+
+#ifdef DEBUG
+		curl_easy_setopt(req->curl, CURLOPT_VERBOSE, 1L);
+		/* libcurl directs verbose output to stderr, so we'll
+		 * redirect it to stdout here. */
+		curl_easy_setopt(req->curl, CURLOPT_STDERR, stdout);
+#endif
+	}
+	sb_debug(__func__, "init: set up easy handles");
+
+	info->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (info->timer < 0) {
+		sb_print_error(routine, "Failed to create timer");
+		return SB_FALSE;
+	}
+
+	info->multi = curl_multi_init();
+	if (info->multi == NULL) {
+		sb_print_error(routine, "Failed to initialize curl multi handle");
+		return SB_FALSE;
+	}
+
+	curl_multi_setopt(info->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(info->multi, CURLMOPT_SOCKETFUNCTION, sb_weather_socket_cb);
+	curl_multi_setopt(info->multi, CURLMOPT_SOCKETDATA, routine);
+	curl_multi_setopt(info->multi, CURLMOPT_TIMERFUNCTION, sb_weather_timer_cb);
+	curl_multi_setopt(info->multi, CURLMOPT_TIMERDATA, info);
+	sb_debug(__func__, "init: set up multi handle");
+
+	return sb_watch_add(routine, info->timer, POLLIN);
+}
+
+static void sb_weather_cache_path(struct sb_weather_t *info)
+{
+	/* This will find the path to the cache file, creating the directories on the way to it. */
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char        dir[sizeof(info->cache) - 16];
+
+	info->cache[0] = '\0';
+	if (base != NULL && base[0] == '/') {
+		snprintf(dir, sizeof(dir), "%s", base);
+	} else if (home != NULL && home[0] != '\0') {
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+	} else {
+		return;
+	}
+
+	mkdir(dir, 0700);
+	strncat(dir, "/statusbar", sizeof(dir)-strlen(dir)-1);
+	mkdir(dir, 0700);
+
+	snprintf(info->cache, sizeof(info->cache), "%s/weather", dir);
+}
+
+static SB_BOOL sb_weather_read_cache(struct sb_weather_t *info)
+{
+	/* The cache file has one key=value pair on each line:
+	 * zip=90210
+	 * time=1577836800
+	 * forecast=https://api.weather.gov/gridpoints/LOX/149,48/forecast
+	 * It is only used if it is for the zip code in config.h and hasn't expired. */
+	FILE   *file;
+	char    line[256];
+	char    zip[32]     = "";
+	char    url[128]    = "";
+	time_t  saved       = 0;
+	size_t  len;
+
+	if (weather_cache_ttl <= 0 || info->cache[0] == '\0')
+		return SB_FALSE;
+
+	file = fopen(info->cache, "re");
+	if (file == NULL)
+		return SB_FALSE;
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		len = strcspn(line, "\n");
+		line[len] = '\0';
+		if (strncmp(line, "zip=", 4) == 0) {
+			snprintf(zip, sizeof(zip), "%s", line + 4);
+		} else if (strncmp(line, "time=", 5) == 0) {
+			saved = (time_t)atoll(line + 5);
+		} else if (strncmp(line, "forecast=", 9) == 0) {
+			snprintf(url, sizeof(url), "%s", line + 9);
+		}
+	}
+	fclose(file);
+
+	if (strcmp(zip, zip_code) != 0 || url[0] == '\0' || time(NULL) - saved >= weather_cache_ttl) {
+		sb_debug(__func__, "init: cache in %s is stale", info->cache);
+		return SB_FALSE;
+	}
+
+	strncpy(info->url2, url, sizeof(info->url2)-1);
+	strncpy(info->url, info->url2, sizeof(info->url)-1);
+	strncat(info->url, "/hourly", sizeof(info->url)-strlen(info->url)-1);
+
+	sb_debug(__func__, "init: using forecast URL from %s", info->cache);
+	return SB_TRUE;
+}
+
+static void sb_weather_write_cache(struct sb_weather_t *info, sb_routine_t *routine)
+{
+	/* Write the cache to a temporary file first and then move it into place, so that a
+	 * half-written cache is never read. */
+	FILE *file;
+	char  tmp[sizeof(info->cache) + 8];
+
+	if (weather_cache_ttl <= 0 || info->cache[0] == '\0')
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", info->cache);
+	file = fopen(tmp, "we");
+	if (file == NULL) {
+		sb_print_error(routine, "Failed to open %s", tmp);
+		return;
+	}
+
+	fprintf(file, "zip=%s\ntime=%lld\nforecast=%s\n", zip_code, (long long)time(NULL), info->url2);
+	if (fclose(file) != 0 || rename(tmp, info->cache) != 0) {
+		sb_print_error(routine, "Failed to write %s", info->cache);
+		unlink(tmp);
+		return;
+	}
+
+	sb_debug(__func__, "init: saved forecast URL to %s", info->cache);
+}
+
+static SB_BOOL sb_weather_find_urls(struct sb_weather_t *info, sb_routine_t *routine)
+{
+	/* This will use the cached forecast URL if there is a fresh one. Otherwise, it will start
+	 * looking up the coordinates of the zip code, which sb_weather_event carries on with. */
+	if (sb_weather_read_cache(info))
+		return SB_TRUE;
+
+	snprintf(info->url, sizeof(info->url)-1, SB_WEATHER_ZIP_URL, zip_code);
+	sb_weather_prepare(&(info->reqs[SB_WEATHER_HOURLY]), info->url, NULL, NULL);
+	sb_debug(__func__, "init: set first URL");
+
+	if (!sb_weather_start(&(info->reqs[SB_WEATHER_HOURLY]), routine))
+		return SB_FALSE;
+	info->stage = SB_WEATHER_COORDINATES;
+
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_weather_fetch(struct sb_weather_t *info, sb_routine_t *routine)
+{
+	/* This will start the requests for both forecasts. */
+	const char *urls[SB_WEATHER_DOCS];
+	int         i;
+
+	urls[SB_WEATHER_HOURLY] = info->url;
+	urls[SB_WEATHER_DAILY]  = info->url2;
+	for (i=0; i<SB_WEATHER_DOCS; i++) {
+		sb_weather_prepare(&(info->reqs[i]), urls[i], sb_weather_paths[i], &(info->docs[i]));
+		if (!sb_weather_start(&(info->reqs[i]), routine))
+			return SB_FALSE;
+	}
+	info->stage = SB_WEATHER_FORECASTS;
+	sb_debug(__func__, "started requests");
+
+	return SB_TRUE;
+}
+
+static SB_BOOL sb_weather_finish(struct sb_weather_t *info, sb_routine_t *routine)
+{
+	/* This will read both responses, once both requests are done, and publish the result. */
+	int temp;
+	int low;
+	int high;
+	int i;
+
+	if (sb_weather_read_temperature(info, &temp, routine) &&
+	    sb_weather_read_forecast(info, &low, &high, routine)) {
+		sb_publish(routine, routine->colors.normal, "weather: %d °F (%d/%d)", temp, high, low);
+		return SB_TRUE;
+	}
+
+	for (i=0; i<SB_WEATHER_DOCS; i++)
+		sb_weather_clear_response(&(info->reqs[i]));
+
+	/* The forecast URLs for an area can change. If they are gone, drop the cached ones and
+	 * start looking them up again. */
+	for (i=0; i<SB_WEATHER_DOCS; i++) {
+		if (info->reqs[i].code == 404) {
+			sb_debug(__func__, "forecast URL is gone, looking it up again");
+			if (info->cache[0] != '\0')
+				unlink(info->cache);
+			memset(info->docs, 0, sizeof(info->docs));
+			info->fetch = SB_FALSE;
+			return sb_weather_find_urls(info, routine);
+		}
+	}
+
+	return SB_FALSE;
+}
+#endif
+
+static SB_BOOL sb_weather_init(sb_routine_t *routine)
+{
+#ifdef BUILD_WEATHER
+	if (!sb_weather_init_curl(&sb_weather, routine))
+		return SB_FALSE;
+
+	/* If the forecast URLs aren't cached, this only starts looking them up. The first update
+	 * will most likely come while that is still running, so get the forecasts right after. */
+	sb_weather_cache_path(&sb_weather);
+	sb_weather.fetch = SB_TRUE;
+	if (!sb_weather_find_urls(&sb_weather, routine))
+		return SB_FALSE;
+
+	sb_debug(__func__, "init: successful");
+	return SB_TRUE;
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_weather_update(sb_routine_t *routine)
+{
+	/* This only starts the requests. The result is published from sb_weather_event when
+	 * both of them are done. */
+#ifdef BUILD_WEATHER
+	if (sb_weather.stage != SB_WEATHER_IDLE) {
+		sb_debug(__func__, "last update is still running");
+		return SB_TRUE;
+	}
+
+	return sb_weather_fetch(&sb_weather, routine);
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_weather_event(sb_routine_t *routine, int fd, short revents)
+{
+#ifdef BUILD_WEATHER
+	uint64_t  expirations;
+	int       flags   = 0;
+	int       running = 0;
+	int       pending = 0;
+	CURLMsg  *msg;
+	int       i;
+
+	if (fd == sb_weather.timer) {
+		if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+			return SB_TRUE;
+		curl_multi_socket_action(sb_weather.multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	} else {
+		if (revents & POLLIN)
+			flags |= CURL_CSELECT_IN;
+		if (revents & POLLOUT)
+			flags |= CURL_CSELECT_OUT;
+		if (revents & (POLLERR | POLLHUP))
+			flags |= CURL_CSELECT_ERR;
+		curl_multi_socket_action(sb_weather.multi, fd, flags, &running);
+	}
+
+	while ((msg = curl_multi_info_read(sb_weather.multi, &pending)) != NULL) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		for (i=0; i<SB_WEATHER_DOCS; i++) {
+			if (sb_weather.reqs[i].curl != msg->easy_handle)
+				continue;
+			sb_weather.reqs[i].result = msg->data.result;
+			sb_weather.reqs[i].active = SB_FALSE;
+			curl_multi_remove_handle(sb_weather.multi, msg->easy_handle);
+		}
+	}
+
+	for (i=0; i<SB_WEATHER_DOCS; i++) {
+		if (sb_weather.reqs[i].active)
+			return SB_TRUE;
+	}
+
+	/* Everything that was started is done. Either move on to the next step of looking up the
+	 * forecast URLs, or read the forecasts. */
+	switch (sb_weather.stage) {
+		case SB_WEATHER_COORDINATES:
+			if (!sb_weather_get_coordinates(&sb_weather, routine))
+				return SB_FALSE;
+			sb_weather.stage = SB_WEATHER_POINTS;
+			return sb_weather_start(&(sb_weather.reqs[SB_WEATHER_HOURLY]), routine);
+		case SB_WEATHER_POINTS:
+			if (!sb_weather_get_temperature_url(&sb_weather, routine))
+				return SB_FALSE;
+			sb_weather_write_cache(&sb_weather, routine);
+			if (sb_weather.fetch)
+				return sb_weather_fetch(&sb_weather, routine);
+			sb_weather.stage = SB_WEATHER_IDLE;
+			return SB_TRUE;
+		case SB_WEATHER_FORECASTS:
+			sb_debug(__func__, "requests are done");
+			sb_weather.stage = SB_WEATHER_IDLE;
+			return sb_weather_finish(&sb_weather, routine);
+		case SB_WEATHER_IDLE:
+			break;
+	}
+
+	return SB_TRUE;
+#else
+	(void)routine;
+	(void)fd;
+	(void)revents;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_weather_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_WEATHER
+	struct sb_weather_req *req;
+	int                    i;
+
+	for (i=0; i<SB_WEATHER_DOCS; i++) {
+		req = &(sb_weather.reqs[i]);
+		if (strlen(req->errbuf) > 0)
+			sb_print_error(routine, "cURL error: %s", req->errbuf);
+
+		if (req->active)
+			curl_multi_remove_handle(sb_weather.multi, req->curl);
+		free(req->response);
+		if (req->headers != NULL)
+			curl_slist_free_all(req->headers);
+		curl_easy_cleanup(req->curl);
+	}
+
+	if (sb_weather.multi != NULL)
+		curl_multi_cleanup(sb_weather.multi);
+	if (sb_weather.timer >= 0)
+		close(sb_weather.timer);
+	if (sb_weather.headers != NULL)
+		curl_slist_free_all(sb_weather.headers);
+	memset(&sb_weather, 0, sizeof(sb_weather));
+	sb_weather.timer = -1;
+#else
+	(void)routine;
+#endif
+}
+
+
+/* --- WIFI ROUTINE --- */
+#ifdef BUILD_WIFI
+#define SB_NLA_DATA(nla) ((void *)((char *)(nla) + NLA_HDRLEN))
+#define SB_NLA_LEN(nla)  ((int)(nla)->nla_len - NLA_HDRLEN)
+
+static struct {
+	int          request; /* Generic netlink socket for asking nl80211 about interfaces. */
+	int          events;  /* Generic netlink socket that nl80211 sends events to. */
+	uint16_t     family;  /* nl80211 family ID, or 0 if wireless extensions are used instead. */
+	uint32_t     seq;     /* Sequence number of the last request. */
+	struct iwreq iwr;
+	char         essid[IW_ESSID_MAX_SIZE + 1];
+	SB_BOOL      found;
+} sb_wifi;
+
+/* What nl80211 told us about the wireless interface. */
+struct sb_wifi_link {
+	int     index;                         /* Interface index, or 0 if there is none. */
+	char    ssid[IW_ESSID_MAX_SIZE + 1];   /* Network the interface is connected to. */
+	SB_BOOL connected;
+	int     signal;                        /* Signal strength, in dBm. */
+	SB_BOOL have_signal;
+};
+
+/* Multicast groups to join when resolving the nl80211 family. */
+struct sb_wifi_family {
+	uint16_t id;
+	uint32_t groups[2]; /* "mlme" (connect, disconnect, roam) and "config" (interfaces). */
+};
 
-	sb_debug(__func__, "init: open element");
-	if (!sb_volume_get_snd_elem(&mixer, &snd_elem, routine)) {
-		routine->run = SB_FALSE;
-	} else if (snd_mixer_selem_get_playback_dB_range(snd_elem, &min, &max) != 0) {
-		sb_print_error(routine, "Failed to get decibels range");
-		routine->run = SB_FALSE;
-	} else {
-		sb_debug(__func__, "init: opened element");
+typedef void (*sb_wifi_cb)(struct genlmsghdr *genl, int len, void *arg);
+
+static void sb_wifi_parse_attrs(struct nlattr *tb[], int max, void *data, int len)
+{
+	/* Index the netlink attributes in data by their type. */
+	struct nlattr *nla = data;
+	int            type;
+
+	memset(tb, 0, sizeof(*tb) * (max + 1));
+	while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (type <= max)
+			tb[type] = nla;
+		len -= NLA_ALIGN(nla->nla_len);
+		nla  = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
 	}
-	sb_leak_check(__func__);
+}
 
-	while (routine->run) {
-		SB_START_TIMER;
+static SB_BOOL sb_wifi_request(uint16_t family, uint8_t cmd, SB_BOOL dump, uint16_t attr_type,
+		const void *attr, size_t attr_len, sb_wifi_cb cb, void *arg, sb_routine_t *routine)
+{
+	/* This will send one generic netlink request with at most one attribute and pass every
+	 * reply to cb. */
+	char               buf[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	struct nlmsghdr   *nlh  = (struct nlmsghdr *)buf;
+	struct genlmsghdr *genl = NLMSG_DATA(nlh);
+	struct nlattr     *nla;
+	struct nlmsgerr   *err;
+	int                len;
+	SB_BOOL            done = SB_FALSE;
+
+	memset(buf, 0, NLMSG_SPACE(GENL_HDRLEN) + NLA_HDRLEN + NLA_ALIGN(attr_len));
+	nlh->nlmsg_len   = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type  = family;
+	nlh->nlmsg_flags = NLM_F_REQUEST | (dump ? NLM_F_DUMP : 0);
+	nlh->nlmsg_seq   = ++sb_wifi.seq;
+	genl->cmd        = cmd;
+	genl->version    = 1;
+
+	if (attr != NULL) {
+		nla            = (struct nlattr *)(buf + NLMSG_ALIGN(nlh->nlmsg_len));
+		nla->nla_type  = attr_type;
+		nla->nla_len   = NLA_HDRLEN + attr_len;
+		memcpy(SB_NLA_DATA(nla), attr, attr_len);
+		nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+	}
 
-		if (snd_mixer_handle_events(mixer) < 0) {
-			sb_print_error(routine, "Failed to clear mixer");
-			break;
-		} else if (snd_mixer_selem_get_playback_switch(snd_elem, SND_MIXER_SCHN_MONO, &mute) != 0) {
-			sb_print_error(routine, "Failed to get mute state");
-			break;
-		} else if (mute == 0) {
-			sb_debug(__func__, "sound is muted");
-			pthread_mutex_lock(&(routine->mutex));
-			snprintf(routine->output, sizeof(routine->output), "mute");
-			pthread_mutex_unlock(&(routine->mutex));
-		} else if (snd_mixer_selem_get_playback_dB(snd_elem, SND_MIXER_SCHN_MONO, &decibels) != 0) {
-			sb_print_error(routine, "Failed to get decibels");
-			break;
-		} else {
-			sb_debug(__func__, "current decibels: %ld", decibels);
-			perc = sb_normalize_perc((decibels-min)*100/(max-min));
-			perc = rint((float)perc / 10) * 10; /* round to nearest ten */
-			if (perc < 80) {
-				routine->color = routine->colors.normal;
-			} else if (perc < 100) {
-				routine->color = routine->colors.warning;
-			} else {
-				routine->color = routine->colors.error;
-			}
+	if (send(sb_wifi.request, buf, nlh->nlmsg_len, 0) < 0) {
+		sb_print_error(routine, "Failed to send request to nl80211");
+		return SB_FALSE;
+	}
 
-			pthread_mutex_lock(&(routine->mutex));
-			snprintf(routine->output, sizeof(routine->output), "Vol %ld%%", perc);
-			pthread_mutex_unlock(&(routine->mutex));
+	while (!done) {
+		len = recv(sb_wifi.request, buf, sizeof(buf), 0);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		} else if (len <= 0) {
+			sb_print_error(routine, "Failed to receive reply from nl80211");
+			return SB_FALSE;
 		}
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
-	}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != sb_wifi.seq) {
+				continue;
+			} else if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = SB_TRUE;
+				break;
+			} else if (nlh->nlmsg_type == NLMSG_ERROR) {
+				/* An error of 0 is only an acknowledgement. Anything else means the request
+				 * didn't work, which the caller will notice from what cb didn't find. */
+				err = NLMSG_DATA(nlh);
+				if (err->error != 0)
+					sb_debug("Wifi", "request %d failed: %s", cmd, strerror(-err->error));
+				done = SB_TRUE;
+				break;
+			}
 
-	if (mixer != NULL) {
-		snd_mixer_close(mixer);
-		snd_mixer_free(mixer);
+			cb(NLMSG_DATA(nlh), nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), arg);
+			if (!dump)
+				done = SB_TRUE;
+		}
 	}
-	if (snd_elem != NULL)
-		snd_mixer_elem_free(snd_elem);
-#else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
-#endif
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+	return SB_TRUE;
 }
 
+static void sb_wifi_family_cb(struct genlmsghdr *genl, int len, void *arg)
+{
+	/* Pick the family ID and the IDs of the multicast groups out of the family's description. */
+	struct sb_wifi_family *family = arg;
+	struct nlattr         *tb[CTRL_ATTR_MAX + 1];
+	struct nlattr         *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+	struct nlattr         *nla;
+	int                    rem;
+	const char            *name;
+
+	sb_wifi_parse_attrs(tb, CTRL_ATTR_MAX, (char *)genl + GENL_HDRLEN, len);
+	if (tb[CTRL_ATTR_FAMILY_ID] != NULL)
+		family->id = *(uint16_t *)SB_NLA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+	if (tb[CTRL_ATTR_MCAST_GROUPS] == NULL)
+		return;
 
-/* --- WEATHER ROUTINE --- */
-#ifdef BUILD_WEATHER
-struct sb_weather_t {
-	CURL              *curl;
-	struct curl_slist *headers;
-	char               url[128];  /* Temporary URL during init, temperature URL during loop. */
-	char               url2[128]; /* Empty during init, daily forecast URL during loop. */
-	char              *response;
-	size_t             len;
-};
+	nla = SB_NLA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]);
+	rem = SB_NLA_LEN(tb[CTRL_ATTR_MCAST_GROUPS]);
+	while (rem >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= rem) {
+		sb_wifi_parse_attrs(grp, CTRL_ATTR_MCAST_GRP_MAX, SB_NLA_DATA(nla), SB_NLA_LEN(nla));
+		if (grp[CTRL_ATTR_MCAST_GRP_NAME] != NULL && grp[CTRL_ATTR_MCAST_GRP_ID] != NULL) {
+			name = SB_NLA_DATA(grp[CTRL_ATTR_MCAST_GRP_NAME]);
+			if (strcmp(name, NL80211_MULTICAST_GROUP_MLME) == 0)
+				family->groups[0] = *(uint32_t *)SB_NLA_DATA(grp[CTRL_ATTR_MCAST_GRP_ID]);
+			else if (strcmp(name, NL80211_MULTICAST_GROUP_CONFIG) == 0)
+				family->groups[1] = *(uint32_t *)SB_NLA_DATA(grp[CTRL_ATTR_MCAST_GRP_ID]);
+		}
+		rem -= NLA_ALIGN(nla->nla_len);
+		nla  = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+	}
+}
 
-static size_t sb_weather_curl_cb(char *buffer, size_t size, size_t num, void *thunk)
+static void sb_wifi_interface_cb(struct genlmsghdr *genl, int len, void *arg)
 {
-	struct sb_weather_t *info = thunk;
-	size_t               buffer_len;
+	/* Use the first station interface, preferring one that is connected. */
+	struct sb_wifi_link *link = arg;
+	struct nlattr       *tb[NL80211_ATTR_MAX + 1];
+	int                  ssid_len;
 
-	buffer_len     = size*num;
-	info->response = realloc(info->response, info->len + buffer_len + 1);
+	if (link->connected)
+		return;
 
-	memcpy(info->response+info->len, buffer, buffer_len);
+	sb_wifi_parse_attrs(tb, NL80211_ATTR_MAX, (char *)genl + GENL_HDRLEN, len);
+	if (tb[NL80211_ATTR_IFINDEX] == NULL || tb[NL80211_ATTR_IFTYPE] == NULL ||
+	    *(uint32_t *)SB_NLA_DATA(tb[NL80211_ATTR_IFTYPE]) != NL80211_IFTYPE_STATION)
+		return;
 
-	info->len                 += buffer_len;
-	info->response[info->len]  = '\0';
+	if (link->index == 0 || tb[NL80211_ATTR_SSID] != NULL)
+		link->index = *(uint32_t *)SB_NLA_DATA(tb[NL80211_ATTR_IFINDEX]);
 
-	return buffer_len;
+	if (tb[NL80211_ATTR_SSID] != NULL) {
+		ssid_len = SB_NLA_LEN(tb[NL80211_ATTR_SSID]);
+		if (ssid_len > IW_ESSID_MAX_SIZE)
+			ssid_len = IW_ESSID_MAX_SIZE;
+		memcpy(link->ssid, SB_NLA_DATA(tb[NL80211_ATTR_SSID]), ssid_len);
+		link->ssid[ssid_len] = '\0';
+		link->connected      = SB_TRUE;
+	}
 }
 
-static void sb_weather_clear_response(struct sb_weather_t *info)
+static void sb_wifi_station_cb(struct genlmsghdr *genl, int len, void *arg)
 {
-	free(info->response);
+	/* Get the signal strength of the access point we're connected to. */
+	struct sb_wifi_link *link = arg;
+	struct nlattr       *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr       *info[NL80211_STA_INFO_MAX + 1];
 
-	info->response = NULL;
-	info->len      = 0;
-	sb_leak_check(__func__);
+	sb_wifi_parse_attrs(tb, NL80211_ATTR_MAX, (char *)genl + GENL_HDRLEN, len);
+	if (tb[NL80211_ATTR_STA_INFO] == NULL)
+		return;
+
+	sb_wifi_parse_attrs(info, NL80211_STA_INFO_MAX, SB_NLA_DATA(tb[NL80211_ATTR_STA_INFO]),
+			SB_NLA_LEN(tb[NL80211_ATTR_STA_INFO]));
+	if (info[NL80211_STA_INFO_SIGNAL] != NULL) {
+		link->signal      = *(int8_t *)SB_NLA_DATA(info[NL80211_STA_INFO_SIGNAL]);
+		link->have_signal = SB_TRUE;
+	}
 }
 
-static SB_BOOL sb_weather_perform_curl(struct sb_weather_t *info, const char *data, sb_routine_t *routine)
+static SB_BOOL sb_wifi_open_nl80211(sb_routine_t *routine)
 {
-	CURLcode  ret;
-	long      code;
-	char     *type; /* this will get free'd during curl_easy_cleanup() */
-
-	ret = curl_easy_perform(info->curl);
-	if (ret != CURLE_OK) {
-		sb_print_error(routine, "Failed to get %s: %s", data, curl_easy_strerror(ret));
+	/* This will look up the nl80211 family and subscribe to its events. If the kernel
+	 * doesn't know about nl80211 (no cfg80211), the family stays 0 and we fall back to
+	 * wireless extensions. */
+	struct sb_wifi_family family;
+	int                   i;
+
+	memset(&family, 0, sizeof(family));
+	sb_wifi.request = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (sb_wifi.request < 0) {
+		sb_print_error(routine, "Failed to open netlink socket");
 		return SB_FALSE;
 	}
 
-	curl_easy_getinfo(info->curl, CURLINFO_RESPONSE_CODE, &code);
-	if (code != 200) {
-		sb_print_error(routine, "curl returned %ld for %s", code, data);
+	if (!sb_wifi_request(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, SB_FALSE, CTRL_ATTR_FAMILY_NAME,
+			NL80211_GENL_NAME, sizeof(NL80211_GENL_NAME), sb_wifi_family_cb, &family, routine))
 		return SB_FALSE;
+
+	if (family.id == 0) {
+		/* Wireless extensions don't send events, so they have to be asked every so often. */
+		sb_debug(__func__, "init: nl80211 not available, using wireless extensions");
+		if (routine->interval == 0)
+			routine->interval = 5 * 1000000;
+		return SB_TRUE;
 	}
 
-	/* Check for content type equal to JSON or GeoJSON. */
-    curl_easy_getinfo(info->curl, CURLINFO_CONTENT_TYPE, &type);
-	if (strcasecmp(type, "application/json") != 0 && strcasecmp(type, "application/geo+json") != 0) {
-		sb_print_error(routine, "Mismatch content type (%s) for %s", type, data);
+	sb_wifi.events = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_GENERIC);
+	if (sb_wifi.events < 0) {
+		sb_print_error(routine, "Failed to open netlink socket");
 		return SB_FALSE;
 	}
 
-	return SB_TRUE;
+	for (i=0; i<2; i++) {
+		if (family.groups[i] != 0 && setsockopt(sb_wifi.events, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+				&family.groups[i], sizeof(family.groups[i])) < 0) {
+			sb_print_error(routine, "Failed to subscribe to nl80211 events");
+			return SB_FALSE;
+		}
+	}
+
+	sb_wifi.family = family.id;
+	sb_debug(__func__, "init: using nl80211 (family %u)", family.id);
+	return sb_watch_add(routine, sb_wifi.events, POLLIN);
 }
 
-static SB_BOOL sb_weather_get_forecast(struct sb_weather_t *info, int *low, int *high, sb_routine_t *routine)
+static SB_BOOL sb_wifi_find_interface(struct iwreq *iwr, char *essid, size_t max_len, sb_routine_t *routine)
 {
-	cJSON *json;
-	cJSON *tmp;
-	cJSON *array;
-	int    i;
+	int             sock;
+	struct ifaddrs *ifaddrs = NULL;
+	struct ifaddrs *ifap;
 
-	/* Set daily forecast URL. */
-	curl_easy_setopt(info->curl, CURLOPT_URL, info->url2);
+	memset(essid, 0, max_len);
+	iwr->u.essid.pointer = (caddr_t *)essid;
+	iwr->u.data.length   = max_len;
+	iwr->u.data.flags    = 0;
 
-	sb_debug(__func__, "get forecast");
-	if (!sb_weather_perform_curl(info, "daily forecast", routine))
-		return SB_FALSE;
+	sb_debug(__func__, "initializing wifi");
 
-	json = cJSON_Parse(info->response);
-	if (json == NULL) {
-		sb_print_error(routine, "Failed to parse forecast response");
-		cJSON_Delete(json);
+	/* open socket and return file descriptor for it */
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		sb_print_error(routine, "Failed to open socket file descriptor");
 		return SB_FALSE;
 	}
+	sb_debug(__func__, "opened socket");
 
-	tmp = cJSON_GetObjectItem(json, "properties");
-	if (tmp == NULL) {
-		sb_print_error(routine, "Failed to find forecast \"properties\" node");
-		cJSON_Delete(json);
+	/* get all network interfaces */
+	if (getifaddrs(&ifaddrs) < 0 || ifaddrs == NULL) {
+		sb_print_error(routine, "Failed to find interface addresses");
+		close(sock);
 		return SB_FALSE;
 	}
+	ifap = ifaddrs;
+	sb_debug(__func__, "got list of interfaces");
 
-	array = cJSON_GetObjectItem(tmp, "periods");
-	if (array == NULL) {
-		sb_print_error(routine, "Failed to find forecast \"periods\" array node");
-		cJSON_Delete(json);
-		return SB_FALSE;
+	/* go through each interface until one returns an ssid */
+	while (ifap != NULL) {
+		strncpy(iwr->ifr_ifrn.ifrn_name, ifap->ifa_name, IFNAMSIZ);
+		if (ioctl(sock, SIOCGIWESSID, iwr) >= 0) {
+			/* we found a match */
+			freeifaddrs(ifaddrs);
+			close(sock);
+			return SB_TRUE;
+		}
+		/* no match found, try the next interface */
+		ifap = ifap->ifa_next;
 	}
 
-	/* We want to skip past the nodes for Today/This Afternoon and Tonight and grab the next two after that. */
-	i   = 0;
-	tmp = cJSON_GetArrayItem(array, 0);
-	tmp = cJSON_GetObjectItem(tmp, "name");
-	if (strcmp(tmp->valuestring, "Overnight") == 0) {
-		i = 3;
-	} else if (strcmp(tmp->valuestring, "Today") == 0 || strcmp(tmp->valuestring, "This Afternoon") == 0) {
-		i = 2;
-	} else if (strcmp(tmp->valuestring, "Tonight") == 0) {
-		i = 1;
-	} else {
-		i = 0;
-		sb_print_error(routine, "Error in forecast array");
-		sb_print_error(routine, "  Unknown value: %s", tmp->valuestring);
+	/* if we reached here, then we didn't find anything */
+	sb_print_error(routine, "No wireless interfaces found");
+	freeifaddrs(ifaddrs);
+	close(sock);
+	return SB_FALSE;
+}
+
+static SB_BOOL sb_wifi_update_wext(sb_routine_t *routine)
+{
+	/* First, we are going to loop through all network interfaces, checking for an SSID.
+	 * When we find one, we'll use that interface as the wireless network. We'll run this
+	 * again if the wireless connection ever goes down until we find another suitable
+	 * connection. Until then, we'll print "Wifi Down". */
+	int         sock;
+	const char *color;
+
+	memset(sb_wifi.essid, 0, sizeof(sb_wifi.essid));
+	if (!sb_wifi.found && !sb_wifi_find_interface(&sb_wifi.iwr, sb_wifi.essid, sizeof(sb_wifi.essid), routine))
+		return SB_FALSE;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		sb_print_error(routine, "Failed to open socket file descriptor");
+		return SB_FALSE;
 	}
 
-	tmp   = cJSON_GetArrayItem(array, i);
-	tmp   = cJSON_GetObjectItem(tmp, "temperature");
-	*high = tmp->valueint;
+	if (ioctl(sock, SIOCGIWESSID, &sb_wifi.iwr) < 0) {
+		sb_wifi.found = SB_FALSE;
+		sb_debug(__func__, "wifi is not connected");
+
+		sb_publish(routine, routine->colors.warning, "Not Connected");
+	} else {
+		sb_wifi.found = SB_TRUE;
+		if (strlen(sb_wifi.essid) == 0) {
+			sb_debug(__func__, "wifi is connected but down");
+			snprintf(sb_wifi.essid, sizeof(sb_wifi.essid)-1, "Wifi Down");
+			color = routine->colors.error;
+		} else {
+			sb_debug(__func__, "wifi is operating on network %s", sb_wifi.essid);
+			color = routine->colors.normal;
+		}
 
-	i++;
-	tmp  = cJSON_GetArrayItem(array, i);
-	tmp  = cJSON_GetObjectItem(tmp, "temperature");
-	*low = tmp->valueint;
+		sb_publish(routine, color, "%s", sb_wifi.essid);
+	}
+	close(sock);
+	sb_debug(__func__, "closed socket");
 
-	cJSON_Delete(json);
-	sb_weather_clear_response(info);
 	return SB_TRUE;
 }
+#endif
 
-static SB_BOOL sb_weather_get_temperature(struct sb_weather_t *info, int *temp, sb_routine_t *routine)
+static SB_BOOL sb_wifi_init(sb_routine_t *routine)
 {
-	cJSON *json;
-	cJSON *tmp;
+	/* This routine will ask nl80211 for the SSID and signal strength of the wireless
+	 * interface, and then wait for nl80211 to tell us when we connect, disconnect, or roam.
+	 * The signal strength has no events, so it is only refreshed by those and by the interval.
+	 * On kernels without nl80211, it falls back to asking wireless extensions every interval. */
+#ifdef BUILD_WIFI
+	sb_wifi.found   = SB_FALSE;
+	sb_wifi.family  = 0;
+	sb_wifi.request = -1;
+	sb_wifi.events  = -1;
+	return sb_wifi_open_nl80211(routine);
+#else
+	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
+	return SB_FALSE;
+#endif
+}
 
-	/* Set hourly temperature URL. */
-	curl_easy_setopt(info->curl, CURLOPT_URL, info->url);
+static SB_BOOL sb_wifi_update(sb_routine_t *routine)
+{
+#ifdef BUILD_WIFI
+	struct sb_wifi_link link;
+	uint32_t            index;
+	long                perc;
 
-	sb_debug(__func__, "get current temperature");
-	if (!sb_weather_perform_curl(info, "temperature", routine))
-		return SB_FALSE;
+	if (sb_wifi.family == 0)
+		return sb_wifi_update_wext(routine);
 
-	json = cJSON_Parse(info->response);
-	if (json == NULL) {
-		sb_print_error(routine, "Failed to parse temperature response");
-		cJSON_Delete(json);
+	memset(&link, 0, sizeof(link));
+	if (!sb_wifi_request(sb_wifi.family, NL80211_CMD_GET_INTERFACE, SB_TRUE, 0, NULL, 0,
+			sb_wifi_interface_cb, &link, routine))
 		return SB_FALSE;
+
+	if (link.index == 0) {
+		sb_debug(__func__, "no wireless interface");
+		sb_publish(routine, routine->colors.error, "Wifi Down");
+		return SB_TRUE;
+	} else if (!link.connected) {
+		sb_debug(__func__, "wifi is not connected");
+		sb_publish(routine, routine->colors.warning, "Not Connected");
+		return SB_TRUE;
 	}
 
-	tmp = cJSON_GetObjectItem(json, "properties");
-	if (tmp == NULL) {
-		sb_print_error(routine, "Failed to find temperature \"properties\" node");
-		cJSON_Delete(json);
+	index = link.index;
+	if (!sb_wifi_request(sb_wifi.family, NL80211_CMD_GET_STATION, SB_TRUE,
+			NL80211_ATTR_IFINDEX, &index, sizeof(index), sb_wifi_station_cb, &link, routine))
 		return SB_FALSE;
+
+	sb_debug(__func__, "wifi is operating on network %s", link.ssid);
+	if (link.have_signal) {
+		/* Map -100 dBm (unusable) through -50 dBm (excellent) onto 0 - 100 %. */
+		perc = sb_normalize_perc(2 * (link.signal + 100));
+		sb_publish(routine, routine->colors.normal, "%s %ld%%", link.ssid, perc);
+	} else {
+		sb_publish(routine, routine->colors.normal, "%s", link.ssid);
 	}
 
-	tmp = cJSON_GetObjectItem(tmp, "periods");
-	if (tmp == NULL) {
-		sb_print_error(routine, "Failed to find temperature \"periods\" array node");
-		cJSON_Delete(json);
-		return SB_FALSE;
+	return SB_TRUE;
+#else
+	(void)routine;
+	return SB_FALSE;
+#endif
+}
+
+static SB_BOOL sb_wifi_event(sb_routine_t *routine, int fd, short revents)
+{
+	/* nl80211 told us that we connected, disconnected, or roamed, or that an interface came
+	 * or went. Drain the events and look again. */
+#ifdef BUILD_WIFI
+	char buf[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	int  len;
+
+	(void)revents;
+	while (1) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len == 0) {
+			break;
+		} else if (len < 0) {
+			/* ENOBUFS means some events were dropped, which we'll see in the new look anyway. */
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			sb_print_error(routine, "Failed to receive nl80211 events");
+			return SB_FALSE;
+		}
 	}
 
-	tmp = cJSON_GetArrayItem(tmp, 0);
-	tmp = cJSON_GetObjectItem(tmp, "temperature");
-	if (tmp == NULL) {
-		sb_print_error(routine, "Failed to find \"temperature\" array node");
-		cJSON_Delete(json);
+	return sb_wifi_update(routine);
+#else
+	(void)routine;
+	(void)fd;
+	(void)revents;
+	return SB_FALSE;
+#endif
+}
+
+static void sb_wifi_cleanup(sb_routine_t *routine)
+{
+#ifdef BUILD_WIFI
+	if (sb_wifi.request >= 0)
+		close(sb_wifi.request);
+	if (sb_wifi.events >= 0)
+		close(sb_wifi.events);
+	sb_wifi.request = -1;
+	sb_wifi.events  = -1;
+#endif
+	(void)routine;
+}
+
+
+/* --- PRINT LOOP --- */
+static void sb_read_output(sb_routine_t *routine, sb_output_t *snapshot)
+{
+	/* This will take a consistent copy of the routine's output and color without ever
+	 * blocking the routine. If the routine wrote to them while we were copying, we try again. */
+	unsigned int seq;
+
+	do {
+		while ((seq = atomic_load_explicit(&(routine->seq), memory_order_acquire)) & 1)
+			sched_yield();
+
+		/* A torn read can give a bad length, so keep it in bounds. The retry will fix it. */
+		snapshot->length = routine->length;
+		if (snapshot->length >= sizeof(snapshot->text))
+			snapshot->length = sizeof(snapshot->text) - 1;
+		memcpy(snapshot->text, routine->output, snapshot->length);
+		snapshot->color      = routine->color;
+		snapshot->generation = atomic_load_explicit(&(routine->generation), memory_order_relaxed);
+
+		atomic_thread_fence(memory_order_acquire);
+	} while (atomic_load_explicit(&(routine->seq), memory_order_relaxed) != seq);
+
+	snapshot->text[snapshot->length] = '\0';
+}
+
+static void sb_buffer_init(sb_buffer_t *buffer, char data[], size_t capacity)
+{
+	buffer->data     = data;
+	buffer->length   = 0;
+	buffer->capacity = capacity;
+	buffer->data[0]  = '\0';
+}
+
+static SB_BOOL sb_buffer_append(sb_buffer_t *buffer, const char *data, size_t length)
+{
+	/* This will add data to the end of the buffer, or leave the buffer alone if it won't fit. */
+	if (buffer->length + length >= buffer->capacity)
 		return SB_FALSE;
-	}
-	*temp = tmp->valueint;
 
-	cJSON_Delete(json);
-	sb_weather_clear_response(info);
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	buffer->data[buffer->length] = '\0';
 	return SB_TRUE;
 }
 
-static SB_BOOL sb_weather_get_temperature_url(struct sb_weather_t *info, sb_routine_t *routine)
+static struct {
+	sb_op_t ops[(DELIMITER + 1) * 7];
+	int     count;
+	char    literals[1024]; /* Storage for literals that were joined together. */
+	size_t  used;
+} sb_template;
+
+static sb_op_t *sb_template_add(enum sb_op_e type, const char *text, sb_routine_t *routine)
 {
-	cJSON *json;
-	cJSON *props;
-	cJSON *url;
+	sb_op_t *op = &(sb_template.ops[sb_template.count++]);
+
+	memset(op, 0, sizeof(*op));
+	op->type    = type;
+	op->text    = text;
+	op->length  = text != NULL ? strlen(text) : 0;
+	op->routine = routine;
+	return op;
+}
 
-	sb_debug(__func__, "init: getting temperature URL info");
-	if (!sb_weather_perform_curl(info, "forecast url", routine))
-		return SB_FALSE;
+static void sb_template_join(const char *text)
+{
+	/* This will add text to the end of the previous literal, so that both are copied in one
+	 * go. If there isn't room to store the joined literal, text gets an op of its own. */
+	sb_op_t *prev = &(sb_template.ops[sb_template.count-1]);
+	size_t   len  = strlen(text);
+	char    *end  = sb_template.literals + sb_template.used;
+
+	if (prev->type != SB_OP_LITERAL ||
+	    sb_template.used + prev->length + len >= sizeof(sb_template.literals)) {
+		sb_template_add(SB_OP_LITERAL, text, NULL);
+		return;
+	}
 
-	json = cJSON_Parse(info->response);
-	if (json == NULL) {
-		sb_print_error(routine, "Failed to parse properties response");
-		cJSON_Delete(json);
-		return SB_FALSE;
+	/* Move the previous literal into storage first, unless it is already at the end of it. */
+	if (prev->text + prev->length != end) {
+		memcpy(end, prev->text, prev->length);
+		prev->text        = end;
+		sb_template.used += prev->length;
 	}
-	sb_debug(__func__, "init: read JSON");
 
-	props = cJSON_GetObjectItem(json, "properties");
-	if (props == NULL) {
-		sb_print_error(routine, "Failed to find \"properties\" node");
-		cJSON_Delete(json);
-		return SB_FALSE;
+	memcpy(sb_template.literals + sb_template.used, text, len);
+	sb_template.used += len;
+	prev->length     += len;
+}
+
+static void sb_template_compile(void)
+{
+	/* The order of the routines and the text around them never change, so this will work out
+	 * the layout of the status bar once. Printing is then a matter of running through the ops
+	 * and copying each piece into place. */
+	sb_routine_t *routine;
+	sb_op_t      *group;
+
+	sb_template.count = 0;
+	sb_template.used  = 0;
+	for (routine = routine_list; routine != NULL; routine = routine->next) {
+		if (routine->routine == DELIMITER) {
+			sb_template_add(SB_OP_LITERAL, bar_delimiter, NULL);
+			continue;
+		}
+
+		/* Literals are only joined within a routine's ops, so that they are skipped along
+		 * with the routine's output when it is empty. */
+		group = sb_template_add(SB_OP_ROUTINE, NULL, routine);
+		sb_template_add(SB_OP_LITERAL, routine_prefix, NULL);
+		if (color_text) {
+			/* Wrap the output in status2d color codes. */
+			sb_template_join("^c");
+			sb_template_add(SB_OP_COLOR, NULL, NULL);
+			sb_template_add(SB_OP_LITERAL, "^", NULL);
+			sb_template_add(SB_OP_TEXT, NULL, NULL);
+			sb_template_add(SB_OP_LITERAL, "^d^", NULL);
+			sb_template_join(routine_suffix);
+		} else {
+			sb_template_add(SB_OP_TEXT, NULL, NULL);
+			sb_template_add(SB_OP_LITERAL, routine_suffix, NULL);
+		}
+		group->skip = &(sb_template.ops[sb_template.count]) - group - 1;
 	}
-	sb_debug(__func__, "init: found \"properties\" node");
 
-	url = cJSON_GetObjectItem(props, "forecast");
-	if (url == NULL) {
-		sb_print_error(routine, "Failed to find \"forecast\" node");
-		cJSON_Delete(json);
-		return SB_FALSE;
+	sb_debug(__func__, "compiled %d ops", sb_template.count);
+}
+
+static void sb_template_render(sb_buffer_t *buffer)
+{
+	/* This will build the status bar by running through the compiled ops. If a routine's
+	 * output doesn't fit, the status bar is cut off before it. */
+	const sb_op_t *op;
+	const sb_op_t *end = sb_template.ops + sb_template.count;
+	sb_output_t    snapshot;
+	size_t         start = 0;
+
+	snapshot.length = 0;
+	snapshot.color  = NULL;
+	for (op = sb_template.ops; op < end; op++) {
+		switch (op->type) {
+			case SB_OP_ROUTINE:
+				sb_read_output(op->routine, &snapshot);
+				op->routine->printed = snapshot.generation;
+				start                = buffer->length;
+				if (snapshot.length == 0) {
+					sb_debug(__func__, "%s: empty, skipping", op->routine->name);
+					op += op->skip;
+				}
+				continue;
+			case SB_OP_LITERAL:
+				if (sb_buffer_append(buffer, op->text, op->length))
+					continue;
+				break;
+			case SB_OP_COLOR:
+				if (sb_buffer_append(buffer, snapshot.color, strlen(snapshot.color)))
+					continue;
+				break;
+			case SB_OP_TEXT:
+				if (sb_buffer_append(buffer, snapshot.text, snapshot.length))
+					continue;
+				break;
+		}
+
+		/* Out of room. Take back whatever part of the last routine was already copied. */
+		fprintf(stderr, "Print: exceeded max output length\n");
+		buffer->length      = start;
+		buffer->data[start] = '\0';
+		return;
 	}
-	sb_debug(__func__, "init: found \"forecast\" node");
+}
 
-	/* Store daily forecast URL. */
-	strncpy(info->url2, url->valuestring, sizeof(info->url2)-1);
-	sb_debug(__func__, "init: stored daily forecast URL");
+static void sb_print_get_time(char buf[], size_t size, struct timespec *start_tp, SB_BOOL blink)
+{
+	struct tm  tm;
+	char      *colon;
+
+	/* convert time from seconds since epoch to local time */
+	memset(&tm, 0, sizeof(tm));
+	localtime_r(&(start_tp->tv_sec), &tm);
+
+	strftime(buf, size-1, time_format, &tm);
+
+	colon = strchr(buf, ':');
+	if (blink && colon != NULL)
+		*colon = ' ';
+}
+
+static SB_BOOL sb_print_changed(struct timespec *tp)
+{
+	/* This will update the time and check whether any routine's output or color changed
+	 * since the last print. The colon blinks with the seconds of the clock rather than with
+	 * each print, so that extra prints in the same second don't change the time. */
+	sb_routine_t *routine;
+	char          buf[sizeof(routine->output)];
+	SB_BOOL       changed = SB_FALSE;
+
+	for (routine = routine_list; routine != NULL; routine = routine->next) {
+		if (routine->routine == TIME) {
+			sb_debug(__func__, "printing time");
+			sb_print_get_time(buf, sizeof(buf), tp, tp->tv_sec % 2 ? SB_TRUE : SB_FALSE);
+			sb_publish(routine, routine->colors.normal, "%s", buf);
+		}
 
-	/* Store hourly temperature URL. */
-	strncpy(info->url, info->url2, sizeof(info->url)-1);
-	strncat(info->url, "/hourly", sizeof(info->url)-strlen(info->url)-1);
-	sb_debug(__func__, "stored hourly temperature URL");
+		if (atomic_load_explicit(&(routine->generation), memory_order_acquire) != routine->printed)
+			changed = SB_TRUE;
+	}
 
-	cJSON_Delete(json);
-	sb_weather_clear_response(info);
-	return SB_TRUE;
+	return changed;
 }
 
-static SB_BOOL sb_weather_get_coordinates(struct sb_weather_t *info, sb_routine_t *routine)
+static void sb_print_output(Display *dpy, Window root)
 {
- 	/* A successful response will look something like this:
-	 * {"status":1,"output":[{"zip":"90210","latitude":"34.103131","longitude":"-118.416253"}]}
-	 * An unsuccessful response will look something like this:
-	 * {"status":-3,"msg":"No results found"}
-	 */
-	cJSON *json;
-	cJSON *tmp;
-	cJSON *num;
-	float  lat;
-	float  lon;
+	struct timespec tp;
+	char            full_output[SBLENGTH];
+	sb_buffer_t     buffer;
 
-	sb_debug(__func__, "init: getting coordinates info");
-	if (!sb_weather_perform_curl(info, "coordinates", routine))
-		return SB_FALSE;
+	sb_debug(__func__, "starting print loop");
+	clock_gettime(CLOCK_REALTIME, &tp);
 
-	json = cJSON_Parse(info->response);
-	if (json == NULL) {
-		sb_print_error(routine, "Failed to parse zip code response");
-		cJSON_Delete(json);
-		return SB_FALSE;
+	if (!sb_print_changed(&tp)) {
+		sb_debug(__func__, "nothing changed, skipping");
+		return;
 	}
-	sb_debug(__func__, "init: opened JSON");
 
-	/* Check that we don't have an error status code. */
-	tmp = cJSON_GetObjectItem(json, "status");
-	if (tmp->valueint != 1) {
-		sb_print_error(routine, "Response returned code %d", tmp->valueint);
-		cJSON_Delete(json);
-		return SB_FALSE;
-	}
+	sb_buffer_init(&buffer, full_output, sizeof(full_output));
+	sb_template_render(&buffer);
 
-	tmp = cJSON_GetObjectItem(json, "output");
-	tmp = cJSON_GetArrayItem(tmp, 0);
-	if (tmp == NULL) {
-		sb_print_error(routine, "Failed to find \"output\" node");
-		cJSON_Delete(json);
-		return SB_FALSE;
-	} else {
-		sb_debug(__func__, "init: found \"output\" node");
+	sb_debug(__func__, "send output to statusbar");
+	XStoreName(dpy, root, full_output);
+	XSync(dpy, False);
+}
+
+
+/* --- SCHEDULING --- */
+static void sb_routine_stop(sb_routine_t *routine)
+{
+	int i;
+
+	routine->run = SB_FALSE;
+	for (i=0; i<SB_MAX_WATCHES; i++) {
+		if (routine->watches[i].events != 0)
+			sb_watch_remove(routine, routine->watches[i].fd);
 	}
+	if (routine->cleanup != NULL)
+		routine->cleanup(routine);
+	sb_leak_check(routine->name);
+}
 
-	num  = cJSON_GetObjectItem(tmp, "latitude");
-	lat = atof(num->valuestring);
-	sb_debug(__func__, "init: using latitude %f", lat);
+static SB_BOOL sb_watch_run(sb_watch_t *watch, short revents)
+{
+	/* Pass the events on a watched file descriptor to its routine. */
+	sb_routine_t *routine = watch->routine;
 
-	num  = cJSON_GetObjectItem(tmp, "longitude");
-	lon = atof(num->valuestring);
-	sb_debug(__func__, "init: using longitude %f", lon);
+	if (!routine->run || watch->events == 0)
+		return SB_TRUE;
 
-	/* Write coordinates into next url, which is for getting the zone and identifiers of the area. */
-	snprintf(info->url, sizeof(info->url)-1, "https://api.weather.gov/points/%.4f,%.4f", lat, lon);
-	curl_easy_setopt(info->curl, CURLOPT_URL, info->url);
-	sb_debug(__func__, "init: prepared next URL");
+	if (!routine->event(routine, watch->fd, revents))
+		return SB_FALSE;
 
-	cJSON_Delete(json);
-	sb_weather_clear_response(info);
+	sb_leak_check(routine->name);
 	return SB_TRUE;
 }
 
-static SB_BOOL sb_weather_init_curl(struct sb_weather_t *info, char errbuf[], sb_routine_t *routine)
+static SB_BOOL sb_routine_wait(const struct timespec *deadline, sb_routine_t *routine)
 {
-	sb_debug(__func__, "init: intializing libcurl object");
-	memset(info, 0, sizeof(*info));
+	/* This will wait until deadline, or forever if deadline is NULL. While waiting, events
+	 * on the routine's watched file descriptors are handled as they come in. Returns SB_FALSE
+	 * if handling an event failed. */
+	struct pollfd   fds[SB_MAX_WATCHES];
+	sb_watch_t     *watch;
+	struct timespec now;
+	long            usec;
+	int             timeout;
+	int             num_fds;
+	int             ret;
+	int             i;
 
-	info->curl = curl_easy_init();
-	if (info->curl == NULL) {
-		sb_print_error(routine, "Failed to initialize curl handle");
-		return SB_FALSE;
-	}
+	while (routine->run) {
+		num_fds = 0;
+		for (i=0; i<SB_MAX_WATCHES; i++) {
+			if (routine->watches[i].events == 0)
+				continue;
+			fds[num_fds].fd      = routine->watches[i].fd;
+			fds[num_fds].events  = routine->watches[i].events;
+			fds[num_fds].revents = 0;
+			num_fds++;
+		}
 
-	info->headers = curl_slist_append(NULL, "accept: application/json");
-	curl_easy_setopt(info->curl, CURLOPT_HTTPHEADER, info->headers);
-	sb_debug(__func__, "init: set header");
+		/* Without anything to watch, there is nothing to do but sleep. */
+		if (num_fds == 0) {
+			if (deadline == NULL) {
+				pause();
+				continue;
+			}
+			while ((ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL)) == EINTR);
+			if (ret != 0)
+				sb_print_error(routine, "Error sleeping");
+			return SB_TRUE;
+		}
 
-	snprintf(info->url, sizeof(info->url)-1, "https://api.promaptools.com/service/us/zip-lat-lng/get/?zip=%s&key=17o8dysaCDrgv1c", zip_code);
-	curl_easy_setopt(info->curl, CURLOPT_URL, info->url);
-	sb_debug(__func__, "init: set first URL");
+		timeout = -1;
+		if (deadline != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			usec = sb_timespec_diff(&now, deadline);
+			if (usec <= 0)
+				return SB_TRUE;
+			timeout = (usec + 999) / 1000;
+		}
 
-	curl_easy_setopt(info->curl, CURLOPT_ERRORBUFFER, errbuf);
-	sb_debug(__func__, "init: set error buffer");
+		ret = poll(fds, num_fds, timeout);
+		if (ret < 0 && errno != EINTR) {
+			sb_print_error(routine, "Error waiting for events");
+			return SB_TRUE;
+		}
 
-	curl_easy_setopt(info->curl, CURLOPT_USERAGENT, "curl/7.9.7+");
-	sb_debug(__func__, "init: set user agent");
+		/* Handling an event can add and remove watches, which can put a different fd in the
+		 * slot that an earlier fd was polled from. Look each fd up again so that its events
+		 * only go to its own watch, and drop them if it is no longer watched. */
+		for (i=0; i<num_fds && ret > 0; i++) {
+			if (fds[i].revents == 0)
+				continue;
+			watch = sb_watch_find(routine, fds[i].fd);
+			if (watch != NULL && !sb_watch_run(watch, fds[i].revents))
+				return SB_FALSE;
+		}
+	}
 
-	curl_easy_setopt(info->curl, CURLOPT_WRITEFUNCTION, sb_weather_curl_cb);
-	sb_debug(__func__, "init: set write callback function");
+	return SB_TRUE;
+}
 
-	curl_easy_setopt(info->curl, CURLOPT_WRITEDATA, info);
-	sb_debug(__func__, "init: set write callback data");
+static long sb_skip_missed(struct timespec *deadline, const struct timespec *now, long interval)
+{
+	/* If deadline has already passed, this will move it to the first deadline after now on
+	 * its grid of deadlines, which are interval microseconds apart. Returns how late deadline
+	 * was in microseconds, or 0 if it hadn't passed. */
+	long late;
 
-#ifdef DEBUG
-	curl_easy_setopt(info->curl, CURLOPT_VERBOSE, 1L);
-	/* libcurl directs verbose output to stderr, so we'll
- 	 * redirect it to stdout here. */
-	curl_easy_setopt(info->curl, CURLOPT_STDERR, stdout);
-	sb_debug(__func__, "init: set verbose mode");
-#endif
+	late = sb_timespec_diff(deadline, now);
+	if (late <= 0)
+		return 0;
 
-	return SB_TRUE;
+	sb_timespec_add(deadline, ((late / interval) + 1) * interval);
+	return late;
 }
-#endif
 
-static void *sb_weather_routine(void *thunk)
+static SB_BOOL sb_sleep_until(struct timespec *deadline, sb_routine_t *routine)
 {
-	sb_routine_t *routine = thunk;
+	/* This will move deadline to the next run on the routine's grid of deadlines and sleep
+	 * until then. If the routine overran, the overrun policy decides whether the missed runs
+	 * are made up or skipped. */
+	struct timespec now;
+	long            late;
+
+	sb_timespec_add(deadline, routine->interval);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (overrun == SB_OVERRUN_SKIP) {
+		late = sb_skip_missed(deadline, &now, routine->interval);
+		if (late > 0)
+			sb_debug(routine->name, "overran by %ld usec, skipping", late);
+	}
 
-#ifdef BUILD_WEATHER
+	return sb_routine_wait(deadline, routine);
+}
+
+static void *sb_routine_thread(void *thunk)
+{
+	/* This drives a single routine from its own thread, sleeping between updates. */
+	sb_routine_t   *routine  = thunk;
+	struct timespec deadline = epoch;
+	SB_BOOL         ok       = SB_TRUE;
 	SB_TIMER_VARS;
-	struct sb_weather_t info;
-	char                errbuf[CURL_ERROR_SIZE] = {0};
-	int                 temp;
-	int                 low;
-	int                 high;
 
-	if (!sb_weather_init_curl(&info, errbuf, routine)) {
+	if (!routine->init(routine))
 		routine->run = SB_FALSE;
-	} else if (!sb_weather_get_coordinates(&info, routine)) {
-		routine->run = SB_FALSE;
-	} else if (!sb_weather_get_temperature_url(&info, routine)) {
-		routine->run = SB_FALSE;
-	} else {
-		sb_debug(__func__, "init: successful");
-	}
-	sb_leak_check(__func__);
+	sb_leak_check(routine->name);
 
-	routine->color = routine->colors.normal;
 	while (routine->run) {
 		SB_START_TIMER;
 
-		if (!sb_weather_get_temperature(&info, &temp, routine))
-			break;
-		if (!sb_weather_get_forecast(&info, &low, &high, routine))
+		if (!routine->update(routine))
 			break;
 
-		pthread_mutex_lock(&(routine->mutex));
-		snprintf(routine->output, sizeof(routine->output), "weather: %d °F (%d/%d)", temp, high, low);
-		pthread_mutex_unlock(&(routine->mutex));
-
-		sb_leak_check(__func__);
+		sb_leak_check(routine->name);
 		SB_STOP_TIMER;
-		SB_SLEEP;
-	}
-
-	if (strlen(errbuf) > 0)
-		sb_print_error(routine, "cURL error: %s", errbuf);
+		if (routine->interval == 0) {
+			ok = sb_routine_wait(NULL, routine);
+		} else if (schedule == SB_SCHEDULE_ABSOLUTE) {
+			ok = sb_sleep_until(&deadline, routine);
+		} else {
+			/* If the update took longer than the interval, run again right away. */
+			SB_ELAPSED;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			if (elapsed_usec < routine->interval)
+				sb_timespec_add(&deadline, routine->interval - elapsed_usec);
+			ok = sb_routine_wait(&deadline, routine);
+		}
 
-	if (info.response != NULL)
-		free(info.response);
-	if (info.headers != NULL)
-		curl_slist_free_all(info.headers);
-	curl_easy_cleanup(info.curl);
-#else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
-#endif
+		if (!ok)
+			break;
+	}
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
+	sb_routine_stop(routine);
 	return NULL;
 }
 
-
-/* --- WIFI ROUTINE --- */
-#ifdef BUILD_WIFI
-static SB_BOOL sb_wifi_init(struct iwreq *iwr, char *essid, size_t max_len, sb_routine_t *routine)
+static SB_BOOL sb_timer_open(sb_timer_t *timer, long interval, long delay, int epfd)
 {
-	int             sock;
-	struct ifaddrs *ifaddrs = NULL;
-	struct ifaddrs *ifap;
+	/* This will create a timer that expires delay microseconds after program start and then
+	 * every interval microseconds, and add it to the epoll instance. Because the expirations
+	 * are absolute, all timers stay in phase with each other. */
+	struct itimerspec  its;
+	struct epoll_event event;
 
-	memset(essid, 0, max_len);
-	iwr->u.essid.pointer = (caddr_t *)essid;
-	iwr->u.data.length   = max_len;
-	iwr->u.data.flags    = 0;
+	memset(timer, 0, sizeof(*timer));
+	timer->interval = interval;
 
-	sb_debug(__func__, "initializing wifi");
+	timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer->fd < 0)
+		return SB_FALSE;
 
-	/* open socket and return file descriptor for it */
-	sock = socket(AF_INET, SOCK_DGRAM, 0);
-	if (sock < 0) {
-		sb_print_error(routine, "Failed to open socket file descriptor");
+	its.it_interval.tv_sec  = interval / 1000000;
+	its.it_interval.tv_nsec = (interval % 1000000) * 1000;
+	its.it_value            = epoch;
+	sb_timespec_add(&its.it_value, delay);
+	if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		close(timer->fd);
 		return SB_FALSE;
 	}
-	sb_debug(__func__, "opened socket");
 
-	/* get all network interfaces */
-	if (getifaddrs(&ifaddrs) < 0 || ifaddrs == NULL) {
-		sb_print_error(routine, "Failed to find interface addresses");
-		close(sock);
+	memset(&event, 0, sizeof(event));
+	event.events   = EPOLLIN;
+	event.data.ptr = timer;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, timer->fd, &event) < 0) {
+		close(timer->fd);
 		return SB_FALSE;
 	}
-	ifap = ifaddrs;
-	sb_debug(__func__, "got list of interfaces");
 
-	/* go through each interface until one returns an ssid */
-	while (ifap != NULL) {
-		strncpy(iwr->ifr_ifrn.ifrn_name, ifap->ifa_name, IFNAMSIZ);
-		if (ioctl(sock, SIOCGIWESSID, iwr) >= 0) {
-			/* we found a match */
-			freeifaddrs(ifaddrs);
-			close(sock);
-			return SB_TRUE;
-		}
-		/* no match found, try the next interface */
-		ifap = ifap->ifa_next;
-	}
+	sb_debug(__func__, "opened timer for %ld usec", interval);
+	return SB_TRUE;
+}
 
-	/* if we reached here, then we didn't find anything */
-	sb_print_error(routine, "No wireless interfaces found");
-	freeifaddrs(ifaddrs);
-	close(sock);
-	return SB_FALSE;
+static void sb_timer_arm(sb_timer_t *timer, const struct timespec *when)
+{
+	/* Set a one-shot timer to expire at the absolute time when, or disarm it if when is NULL. */
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (when != NULL)
+		its.it_value = *when;
+
+	if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		fprintf(stderr, "Print: Failed to set timer\n");
 }
-#endif
 
-static void *sb_wifi_routine(void *thunk)
+static int sb_timer_compare(const void *a, const void *b)
 {
-	/* First, we are going to loop through all network interfaces, checking for an SSID.
-	 * When we find one, we'll break out of the loop and use that interface as
-	 * the wireless network. We'll run this again if the wireless connection ever goes
-	 * down until we find another suitable connection. Until then, we'll print "Wifi Down". */
-	sb_routine_t *routine = thunk;
+	/* Sort routines by interval, shortest first. */
+	long first  = (*(sb_routine_t *const *)a)->interval;
+	long second = (*(sb_routine_t *const *)b)->interval;
 
-#ifdef BUILD_WIFI
-	SB_TIMER_VARS;
-	struct iwreq iwr;
-	char         essid[IW_ESSID_MAX_SIZE + 1];
-	int          sock;
-	SB_BOOL      found = SB_FALSE;
+	return (first > second) - (first < second);
+}
 
-	while (routine->run) {
-		SB_START_TIMER;
+static int sb_timer_init_all(sb_timer_t timers[], int num_timers, int epfd)
+{
+	/* This will initialize every routine that is run from the event loop and attach it to a
+	 * timer, creating the timer if needed. Without coalescing, routines share a timer only
+	 * if they have the same interval. With coalescing, a routine joins the first timer whose
+	 * interval evenly divides its own. Routines are handled shortest interval first so that
+	 * every group of routines is driven by its fastest member. Returns the number of timers. */
+	sb_routine_t *routine;
+	sb_routine_t *sorted[DELIMITER];
+	int           num_sorted = 0;
+	int           i;
+	int           j;
 
-		memset(essid, 0, sizeof(essid));
-		if (!found && !sb_wifi_init(&iwr, essid, sizeof(essid), routine))
-			break;
+	for (routine = routine_list; routine != NULL; routine = routine->next) {
+		if (!routine->run || routine->threaded || routine->update == NULL)
+			continue;
 
-		sock = socket(AF_INET, SOCK_DGRAM, 0);
-		if (sock < 0) {
-			sb_print_error(routine, "Failed to open socket file descriptor");
-			break;
+		if (!routine->init(routine)) {
+			sb_routine_stop(routine);
+			continue;
 		}
+		sb_debug(routine->name, "initialized in event loop");
 
-		if (ioctl(sock, SIOCGIWESSID, &iwr) < 0) {
-			found = SB_FALSE;
-			routine->color = routine->colors.warning;
-			sb_debug(__func__, "wifi is not connected");
+		/* Routines without an interval run once now and then only on events. */
+		if (routine->interval == 0) {
+			if (!routine->update(routine))
+				sb_routine_stop(routine);
+			continue;
+		}
+		sorted[num_sorted++] = routine;
+	}
+	qsort(sorted, num_sorted, sizeof(*sorted), sb_timer_compare);
 
-			pthread_mutex_lock(&(routine->mutex));
-			snprintf(routine->output, sizeof(routine->output), "Not Connected");
-			pthread_mutex_unlock(&(routine->mutex));
-		} else {
-			found = SB_TRUE;
-			if (strlen(essid) == 0) {
-				sb_debug(__func__, "wifi is connected but down");
-				snprintf(essid, sizeof(essid)-1, "Wifi Down");
-				routine->color = routine->colors.error;
-			} else {
-				sb_debug(__func__, "wifi is operating on network %s", essid);
-				routine->color = routine->colors.normal;
-			}
+	for (j=0; j<num_sorted; j++) {
+		routine = sorted[j];
+		for (i=0; i<num_timers; i++) {
+			if (coalesce && routine->interval % timers[i].interval == 0)
+				break;
+			if (!timers[i].print && routine->interval == timers[i].interval)
+				break;
+		}
 
-			pthread_mutex_lock(&(routine->mutex));
-			snprintf(routine->output, sizeof(routine->output), "%s", essid);
-			pthread_mutex_unlock(&(routine->mutex));
+		if (i == num_timers) {
+			if (!sb_timer_open(&timers[i], routine->interval, 0, epfd)) {
+				fprintf(stderr, "%s: Failed to create timer\n", routine->name);
+				sb_routine_stop(routine);
+				continue;
+			}
+			num_timers++;
 		}
-		close(sock);
-		sb_debug(__func__, "closed socket");
 
-		sb_leak_check(__func__);
-		SB_STOP_TIMER;
-		SB_SLEEP;
+		sb_debug(routine->name, "attached to timer for %ld usec", timers[i].interval);
+		timers[i].periods[timers[i].count]    = routine->interval / timers[i].interval;
+		timers[i].routines[timers[i].count++] = routine;
 	}
-#else
-	sb_print_error(routine, "routine was selected but not built during compilation. Check config.log");
-#endif
 
-	routine->run = SB_FALSE;
-	sb_leak_check(__func__);
-	return NULL;
+	return num_timers;
 }
 
+static uint64_t sb_timer_count_runs(uint64_t ticks, uint64_t period)
+{
+	/* Number of runs due in the first ticks ticks of a timer, for a routine that runs on
+	 * the first tick and then every period ticks. */
+	return ticks == 0 ? 0 : ((ticks - 1) / period) + 1;
+}
 
-/* --- PRINT LOOP --- */
-static void sb_copy_output(char *full_output, sb_routine_t *routine)
+#ifdef BUILD_IO_URING
+static struct io_uring sb_ring;
+static SB_BOOL         sb_ring_ready = SB_FALSE;
+#endif
+
+static void sb_sample_init(void)
+{
+	/* Set up the ring used to read every due routine's files in one batch. If that isn't
+	 * possible (for example, io_uring is disabled in the kernel), the routines read their
+	 * files themselves. */
+#ifdef BUILD_IO_URING
+	if (io_uring_queue_init(DELIMITER * SB_MAX_FILES, &sb_ring, 0) < 0) {
+		fprintf(stderr, "Print: Failed to set up io_uring, reading files one at a time\n");
+		return;
+	}
+	sb_ring_ready = SB_TRUE;
+	sb_debug(__func__, "reading files with io_uring");
+#endif
+}
+
+static void sb_sample_files(sb_timer_t *timers[], const uint64_t expirations[], int num_timers)
 {
-	strcat(full_output, "[");
+	/* Read the files of every routine that is about to run with one submission, so that
+	 * the routines can parse them without making any system calls of their own. */
+#ifdef BUILD_IO_URING
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	sb_routine_t        *routine;
+	sb_file_t           *file;
+	int                  queued = 0;
+	int                  i;
+	int                  j;
+	int                  k;
+
+	if (!sb_ring_ready)
+		return;
 
-	/* Print opening status2d color code. */
-	if (color_text) {
-		strcat(full_output, "^c");
-		strcat(full_output, routine->color);
-		strcat(full_output, "^");
+	for (i=0; i<num_timers; i++) {
+		for (j=0; j<timers[i]->count; j++) {
+			routine = timers[i]->routines[j];
+			if (!routine->run ||
+			    sb_timer_count_runs(timers[i]->ticks + expirations[i], timers[i]->periods[j]) ==
+			    sb_timer_count_runs(timers[i]->ticks, timers[i]->periods[j]))
+				continue;
+
+			for (k=0; k<routine->num_files; k++) {
+				file = routine->files[k];
+				if (file->fd < 0)
+					continue;
+				sqe = io_uring_get_sqe(&sb_ring);
+				if (sqe == NULL)
+					break;
+				io_uring_prep_read(sqe, file->fd, file->data, sizeof(file->data), 0);
+				io_uring_sqe_set_data(sqe, file);
+				queued++;
+			}
+		}
 	}
 
-	strcat(full_output, routine->output);
-	sb_debug(__func__, "%zu bytes: %s", strlen(routine->output), routine->output);
+	if (queued == 0)
+		return;
 
-	/* Print status2d terminator code. */
-	if (color_text)
-		strcat(full_output, "^d^");
+	if (io_uring_submit_and_wait(&sb_ring, queued) < 0) {
+		sb_debug(__func__, "failed to submit %d reads", queued);
+		return;
+	}
 
-	strcat(full_output, "] ");
+	/* Reads that failed are left for the routine, which will reopen the file and try again. */
+	while (queued > 0 && io_uring_peek_cqe(&sb_ring, &cqe) == 0) {
+		file        = io_uring_cqe_get_data(cqe);
+		file->len   = cqe->res;
+		file->ready = cqe->res >= 0 ? SB_TRUE : SB_FALSE;
+		io_uring_cqe_seen(&sb_ring, cqe);
+		queued--;
+	}
+#else
+	(void)timers;
+	(void)expirations;
+	(void)num_timers;
+#endif
 }
 
-static void sb_print_get_time(char buf[], size_t size, struct timespec *start_tp, SB_BOOL blink)
+static void sb_timer_run(sb_timer_t *timer, uint64_t expirations)
 {
-	struct tm tm;
+	/* Update every routine that is due on this tick of the timer, back to back. If the timer
+	 * expired more than once since we last checked, the overrun policy decides how many
+	 * runs to make. */
+	sb_routine_t *routine;
+	uint64_t      runs;
+	int           i;
+
+	if (expirations > 1)
+		sb_debug(__func__, "missed %lu ticks", (unsigned long)(expirations - 1));
+
+	for (i=0; i<timer->count; i++) {
+		routine = timer->routines[i];
+		runs    = sb_timer_count_runs(timer->ticks + expirations, timer->periods[i]) -
+		          sb_timer_count_runs(timer->ticks, timer->periods[i]);
+		if (runs > 1 && overrun == SB_OVERRUN_SKIP)
+			runs = 1;
+
+		for (; runs > 0 && routine->run; runs--) {
+			if (!routine->update(routine)) {
+				sb_routine_stop(routine);
+				break;
+			}
+			sb_leak_check(routine->name);
+		}
+	}
 
-	/* convert time from seconds since epoch to local time */
-	memset(&tm, 0, sizeof(tm));
-	localtime_r(&(start_tp->tv_sec), &tm);
+	timer->ticks += expirations;
+}
 
-	strftime(buf, size-1, time_format, &tm);
+static void sb_print_notified(sb_timer_t *frame_timer, const struct timespec *last_print, SB_BOOL *print)
+{
+	/* A routine has new output. Print right away unless that would come too soon after the
+	 * last print, in which case the frame timer is set to print as soon as it is allowed. */
+	struct timespec now;
+	struct timespec next;
+	uint64_t        count;
+
+	if (read(notify_fd, &count, sizeof(count)) != sizeof(count))
+		return;
 
-	if (blink)
-		*strchr(buf, ':') = ' ';
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	next = *last_print;
+	sb_timespec_add(&next, min_print_interval);
+	if (sb_timespec_diff(&next, &now) >= 0) {
+		*print = SB_TRUE;
+	} else {
+		sb_debug(__func__, "holding print for %ld usec", sb_timespec_diff(&now, &next));
+		sb_timer_arm(frame_timer, &next);
+	}
 }
 
 static void sb_print(void)
 {
-	sb_debug(__func__, "starting...");
-	/* Here, we are not using the SB_START_TIMER and SB_STOP_TIMER macros,
- 	 * because we need to use CLOCK_REALTIME to get the actual system time. */
-	SB_TIMER_VARS
-	Display      *dpy;
-	Window        root;
-	sb_routine_t *routine;
-	char          full_output[SBLENGTH];
-	SB_BOOL       blink = SB_TRUE;
-	size_t        len;
+	/* This is the main loop. It waits on the print timer (and, with the event loop engine,
+	 * on the timers for every routine) and prints the status bar once all of the timers
+	 * that expired together have been handled. It also prints whenever a routine signals
+	 * that its output changed. */
+	Display           *dpy;
+	Window             root;
+	SB_BOOL            print;
+	int                epfd;
+	sb_timer_t         timers[DELIMITER + 1];
+	int                num_timers;
+	sb_timer_t         frame_timer;
+	sb_timer_t        *timer;
+	sb_watch_t        *watch;
+	sb_timer_t        *expired[DELIMITER + 3];
+	uint64_t           counts[DELIMITER + 3];
+	int                num_expired;
+	struct epoll_event event;
+	struct epoll_event events[DELIMITER + 3 + SB_MAX_WATCHES];
+	int                num_events;
+	int                i;
+	uint64_t           expirations;
+	long               delay;
+	struct timespec    last_print = {0};
 
+	sb_debug(__func__, "starting...");
 	dpy  = XOpenDisplay(NULL);
 	root = RootWindow(dpy, DefaultScreen(dpy));
 
-	while (1) {
-		sb_debug(__func__, "starting print loop");
-		clock_gettime(CLOCK_REALTIME, &start_tp); /* START TIMER */
-
-		memset(full_output, 0, SBLENGTH);
-		for (routine = routine_list; routine != NULL; routine = routine->next) {
-			if (routine->routine == DELIMITER) {
-				sb_debug(__func__, "adding delimiter");
-				strcat(full_output, ";");
-				continue;
-			} else if (routine->routine == TIME) {
-				sb_debug(__func__, "printing time");
-				if (blink)
-					blink = SB_FALSE;
-				else
-					blink = SB_TRUE;
-				sb_print_get_time(routine->output, sizeof(routine->output), &start_tp, blink);
-			}
+	/* When routines are coalesced onto the print timer, they run right before the print, so
+	 * there is no need to give them a head start. */
+	delay = (engine == SB_ENGINE_EVENT_LOOP && coalesce) ? 0 : print_delay;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		fprintf(stderr, "Print: Failed to create epoll instance\n");
+	} else if (!sb_timer_open(&timers[0], 1000000, delay, epfd)) {
+		fprintf(stderr, "Print: Failed to create print timer\n");
+	} else if (notify_fd >= 0 && !sb_timer_open(&frame_timer, 0, 0, epfd)) {
+		fprintf(stderr, "Print: Failed to create frame timer\n");
+	} else {
+		/* The notification eventfd is told apart from the timers by its NULL pointer. */
+		memset(&event, 0, sizeof(event));
+		event.events   = EPOLLIN;
+		event.data.ptr = NULL;
+		if (notify_fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, notify_fd, &event) < 0) {
+			fprintf(stderr, "Print: Failed to watch for changes, printing every second\n");
+			close(notify_fd);
+			notify_fd = -1;
+		}
+		if (notify_fd >= 0) {
+			sb_timer_arm(&frame_timer, NULL);
+			frame_timer.print = SB_TRUE;
+		}
 
-			pthread_mutex_lock(&(routine->mutex));
+		timers[0].print = SB_TRUE;
+		num_timers      = 1;
+		sb_template_compile();
+		if (engine == SB_ENGINE_EVENT_LOOP) {
+			sb_loop_fd = epfd;
+			num_timers = sb_timer_init_all(timers, num_timers, epfd);
+			sb_sample_init();
+		}
+		sb_debug(__func__, "running with %d timers", num_timers);
+		sb_leak_check(__func__);
 
-			len = strlen(routine->output);
-			if (len == 0) {
-				sb_debug(__func__, "empty, skipping");
-				pthread_mutex_unlock(&(routine->mutex));
-				continue;
-			} else if (strlen(full_output)+len+1 > SBLENGTH+(color_text?10:0)) {
-				fprintf(stderr, "Print: %s: exceeded max output length\n", routine->name);
-				pthread_mutex_unlock(&(routine->mutex));
+		while (1) {
+			num_events = epoll_wait(epfd, events, sizeof(events) / sizeof(*events), -1);
+			if (num_events < 0) {
+				if (errno == EINTR)
+					continue;
+				fprintf(stderr, "Print: Failed to wait for events\n");
 				break;
 			}
 
-			sb_copy_output(full_output, routine);
+			/* Collect every timer that expired so that the files of all due routines can be
+			 * read together. */
+			print       = SB_FALSE;
+			num_expired = 0;
+			for (i=0; i<num_events; i++) {
+				timer = events[i].data.ptr;
+				if (timer == NULL) {
+					sb_print_notified(&frame_timer, &last_print, &print);
+					continue;
+				} else if (*(enum sb_source_e *)events[i].data.ptr == SB_SOURCE_WATCH) {
+					watch = events[i].data.ptr;
+					if (!sb_watch_run(watch, events[i].events))
+						sb_routine_stop(watch->routine);
+					continue;
+				}
 
-			pthread_mutex_unlock(&(routine->mutex));
-		}
+				if (read(timer->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+					continue;
 
-		sb_debug(__func__, "send output to statusbar");
-		XStoreName(dpy, root, full_output);
-		XSync(dpy, False);
+				expired[num_expired] = timer;
+				counts[num_expired]  = expirations;
+				num_expired++;
+			}
 
-		sb_leak_check(__func__);
-		clock_gettime(CLOCK_REALTIME, &finish_tp); /* STOP TIMER */
-		elapsed_usec = ((finish_tp.tv_sec - start_tp.tv_sec) * 1000000) +
-				((finish_tp.tv_nsec - start_tp.tv_nsec) / 1000);
+			/* Run all due routines first so that the print reflects their new output. */
+			sb_sample_files(expired, counts, num_expired);
+			for (i=0; i<num_expired; i++) {
+				sb_timer_run(expired[i], counts[i]);
+				if (expired[i]->print)
+					print = SB_TRUE;
+			}
+
+			if (print) {
+				sb_print_output(dpy, root);
+				clock_gettime(CLOCK_MONOTONIC, &last_print);
 
-		if (elapsed_usec < 1000000) {
-			if (usleep(1000000 - elapsed_usec) != 0) {
-				fprintf(stderr, "Print routine: Error sleeping\n");
+				/* Everything new has been printed, so any pending notifications are stale. */
+				if (notify_fd >= 0) {
+					sb_timer_arm(&frame_timer, NULL);
+					if (read(notify_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+						fprintf(stderr, "Print: Failed to clear notifications\n");
+				}
+				sb_leak_check(__func__);
 			}
 		}
 	}
@@ -1776,21 +4950,26 @@ static void sb_print(void)
 
 
 static const struct thread_routines_t {
-	void *(*callback)(void *thunk);
+	SB_BOOL (*init)(sb_routine_t *routine);
+	SB_BOOL (*update)(sb_routine_t *routine);
+	SB_BOOL (*event)(sb_routine_t *routine, int fd, short revents);
+	void    (*cleanup)(sb_routine_t *routine);
 } possible_routines[] = {
-	{ sb_battery_routine    },
-	{ sb_cpu_temp_routine   },
-	{ sb_cpu_usage_routine  },
-	{ sb_disk_routine       },
-	{ sb_fan_routine        },
-	{ sb_load_routine       },
-	{ sb_network_routine    },
-	{ sb_ram_routine        },
-	{ sb_null_cb            },
-	{ sb_todo_routine       },
-	{ sb_volume_routine     },
-	{ sb_weather_routine    },
-	{ sb_wifi_routine       },
+	{ sb_battery_init  , sb_battery_update  , sb_battery_event , sb_battery_cleanup   },
+	{ sb_cpu_temp_init , sb_cpu_temp_update , NULL             , sb_cpu_temp_cleanup  },
+	{ sb_cpu_usage_init, sb_cpu_usage_update, NULL             , sb_cpu_usage_cleanup },
+	{ sb_disk_init     , sb_disk_update     , NULL             , NULL                 },
+	{ sb_diskio_init   , sb_diskio_update   , NULL             , sb_diskio_cleanup    },
+	{ sb_fan_init      , sb_fan_update      , NULL             , sb_fan_cleanup       },
+	{ sb_load_init     , sb_load_update     , NULL             , NULL                 },
+	{ sb_network_init  , sb_network_update  , sb_network_event , sb_network_cleanup   },
+	{ sb_pressure_init , sb_pressure_update , sb_pressure_event, sb_pressure_cleanup  },
+	{ sb_ram_init      , sb_ram_update      , NULL             , sb_ram_cleanup       },
+	{ NULL             , NULL               , NULL             , NULL                 }, /* TIME is handled by the print loop */
+	{ sb_todo_init     , sb_todo_update     , sb_todo_event    , sb_todo_cleanup      },
+	{ sb_volume_init   , sb_volume_update   , sb_volume_event  , sb_volume_cleanup    },
+	{ sb_weather_init  , sb_weather_update  , sb_weather_event , sb_weather_cleanup   },
+	{ sb_wifi_init     , sb_wifi_update     , sb_wifi_event    , sb_wifi_cleanup      },
 };
 int main(int argc, char *argv[])
 {
@@ -1816,6 +4995,15 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* everything is scheduled relative to this point */
+	clock_gettime(CLOCK_MONOTONIC, &epoch);
+
+	if (print_on_change) {
+		notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (notify_fd < 0)
+			fprintf(stderr, "Failed to create notification eventfd, printing every second\n");
+	}
+
 	/* mark head of routine list */
 	routine_list = &(routine_array[chosen_routines[0].routine]);
 
@@ -1885,9 +5073,13 @@ int main(int argc, char *argv[])
 			strncpy(routine_object->colors.warning, chosen_routines[i].color_warning, sizeof(routine_object->colors.warning));
 			strncpy(routine_object->colors.error,   chosen_routines[i].color_error,   sizeof(routine_object->colors.error));
 
-			routine_object->thread_func = possible_routines[index].callback;
+			routine_object->init        = possible_routines[index].init;
+			routine_object->update      = possible_routines[index].update;
+			routine_object->event       = possible_routines[index].event;
+			routine_object->cleanup     = possible_routines[index].cleanup;
 			routine_object->interval    = chosen_routines[i].seconds * 1000000;
 			routine_object->color       = routine_object->colors.normal;
+			routine_object->printed     = -1; /* make sure the first print goes through */
 			routine_object->name        = routine_names[index];
 			routine_object->run         = SB_TRUE;
 
@@ -1897,10 +5089,16 @@ int main(int argc, char *argv[])
 			sb_debug(routine_object->name, "warning color: %s", routine_object->colors.warning);
 			sb_debug(routine_object->name, "error color: %s", routine_object->colors.error);
 
-			/* create thread */
-			pthread_mutex_init(&(routine_object->mutex), NULL);
-			pthread_create(&(routine_object->thread), NULL, routine_object->thread_func, (void *)routine_object);
-			sb_debug(routine_object->name, "thread created");
+			if (routine_object->update == NULL) {
+				sb_debug(routine_object->name, "run from print loop");
+			} else if (engine == SB_ENGINE_THREADS) {
+				/* create thread */
+				routine_object->threaded = SB_TRUE;
+				pthread_create(&(routine_object->thread), NULL, sb_routine_thread, (void *)routine_object);
+				sb_debug(routine_object->name, "thread created");
+			} else {
+				sb_debug(routine_object->name, "run from event loop");
+			}
 		}
 	}
 	sb_leak_check(__func__);
@@ -8,11 +8,25 @@
 #include <math.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #ifdef DEBUG_LEAKS
   #include <sanitizer/lsan_interface.h>
 #endif
 
+#ifdef BUILD_BATTERY
+  #include <sys/socket.h>
+  #include <linux/netlink.h>
+#endif
+
 #ifdef BUILD_CPU_USAGE
   #include <sys/sysinfo.h>
 #endif
@@ -21,14 +35,29 @@
   #include <sys/statvfs.h>
 #endif
 
+#ifdef BUILD_DISKIO
+  #include <sys/stat.h>
+  #include <sys/sysmacros.h>
+#endif
+
 #ifdef BUILD_NETWORK
   #include <sys/ioctl.h>
+  #include <sys/socket.h>
   #include <ifaddrs.h>
   #include <net/if.h>
+  #include <linux/netlink.h>
+  #include <linux/rtnetlink.h>
+  #include <linux/if_link.h>
 #endif
 
 #ifdef BUILD_WIFI
   #include <linux/wireless.h>
+  #include <linux/genetlink.h>
+  #include <linux/nl80211.h>
+#endif
+
+#ifdef BUILD_TODO
+  #include <sys/inotify.h>
 #endif
 
 #ifdef BUILD_VOLUME
@@ -36,18 +65,25 @@
 #endif
 
 #ifdef BUILD_WEATHER
+  #include <sys/stat.h>
   #include <curl/curl.h>
   #include "cJSON.h"
 #endif
 
+#ifdef BUILD_IO_URING
+  #include <liburing.h>
+#endif
+
 enum sb_routine_e {
 	BATTERY = 0,
 	CPU_TEMP ,
 	CPU_USAGE,
 	DISK     ,
+	DISKIO   ,
 	FAN      ,
 	LOAD     ,
 	NETWORK  ,
+	PRESSURE ,
 	RAM      ,
 	TIME     ,
 	TODO     ,
@@ -62,25 +98,91 @@ typedef enum _SB_BOOL {
 	SB_TRUE  = 1
 } SB_BOOL;
 
+enum sb_engine_e {
+	SB_ENGINE_THREADS = 0, /* One thread per routine. */
+	SB_ENGINE_EVENT_LOOP , /* All routines are run from the print loop. */
+};
+
+enum sb_schedule_e {
+	SB_SCHEDULE_RELATIVE = 0, /* Sleep for the interval minus the time the update took. */
+	SB_SCHEDULE_ABSOLUTE    , /* Sleep until the next deadline on a fixed grid. */
+};
+
+enum sb_overrun_e {
+	SB_OVERRUN_SKIP = 0, /* Drop missed deadlines and wait for the next one on the grid. */
+	SB_OVERRUN_CATCHUP , /* Run once for every missed deadline, back to back. */
+};
+
+/* Parts of the CPU time that the CPU_USAGE routine can show on their own. These are bit flags. */
+enum sb_cpu_time_e {
+	SB_CPU_USER   = 1 << 0, /* user and nice */
+	SB_CPU_SYSTEM = 1 << 1,
+	SB_CPU_IOWAIT = 1 << 2,
+	SB_CPU_STEAL  = 1 << 3, /* time taken by the hypervisor for other guests */
+	SB_CPU_IRQ    = 1 << 4, /* hardware and software interrupts */
+};
+
+/* Extra memory figures that the RAM routine can show. These are bit flags. */
+enum sb_ram_detail_e {
+	SB_RAM_SWAP      = 1 << 0, /* swap in use */
+	SB_RAM_DIRTY     = 1 << 1, /* dirty pages and pages being written back */
+	SB_RAM_HUGEPAGES = 1 << 2, /* free and total huge pages, if any are reserved */
+};
+
+/* What an epoll event belongs to. This is the first member of every object that is added to
+ * the event loop's epoll instance, so that the object can be told apart from its pointer. */
+enum sb_source_e {
+	SB_SOURCE_TIMER = 0,
+	SB_SOURCE_WATCH    ,
+};
+
+#define SB_MAX_WATCHES 8
+#define SB_MAX_FILES   3
+
+/* File descriptor that a routine wants to be told about, like an inotify instance or a
+ * netlink socket. */
+typedef struct sb_watch {
+	enum sb_source_e   source;  /* Always SB_SOURCE_WATCH. */
+	int                fd;      /* File descriptor to watch. */
+	short              events;  /* poll(2) events to wait for, or 0 if the slot is free. */
+	struct sb_routine *routine; /* Routine to call when the file descriptor is ready. */
+} sb_watch_t;
+
 /* Routine object declaration */
 typedef struct sb_routine {
 	enum sb_routine_e  routine;     /* Number assigned to each routine. This is used to
 	                                   access the routine's flags and to match it to various
 	                                   checks and calls. */
 	const char        *name;        /* Printable name of routine. */
-	long               interval;    /* How often to call routine, in microseconds. */
+	long               interval;    /* How often to call routine, in microseconds. 0 means the
+	                                   routine only runs once and then waits for events. */
 	char               output[256]; /* String of data that each routine will output for
 	                                   master status bar string to copy. */
+	size_t             length;      /* Length of output, not counting the terminator. */
 	const char        *color;       /* Font color for each print cycle. */
+	atomic_uint        seq;         /* Sequence lock for output, length, color, and generation. It is
+	                                   odd while the routine is writing them. Readers copy
+	                                   them out and retry if it changed in the meantime. */
+	atomic_ulong       generation;  /* Incremented every time output or color changes. */
+	unsigned long      printed;     /* Generation that was last printed. Only used by the
+	                                   print loop. */
 	struct {
 		char           normal[8];   /* Font color for normal values. */
 		char           warning[8];  /* Font color when routine is in warning range. */
 		char           error[8];    /* Font color when routine has an error. */
 	} colors;
 	pthread_t          thread;      /* Thread assigned to this routine. */
-	pthread_mutex_t    mutex;       /* Mutex assigned to this routine. This will be used to
-	                                   lock output when reading from or writing to it. */
-	void            *(*thread_func)(void *); /* Callback function for thread. */
+	SB_BOOL            threaded;    /* SB_TRUE if routine runs in its own thread, SB_FALSE
+	                                   if it is run from the event loop. */
+	struct sb_file    *files[SB_MAX_FILES]; /* Files the routine reads every update. The event loop
+	                                   reads them ahead of time in one batch. */
+	int                num_files;   /* Number of files in files. */
+	sb_watch_t         watches[SB_MAX_WATCHES]; /* File descriptors the routine is waiting on. */
+	SB_BOOL          (*init)(struct sb_routine *);    /* Called once before the first update. */
+	SB_BOOL          (*update)(struct sb_routine *);  /* Called every interval. Must not block. */
+	SB_BOOL          (*event)(struct sb_routine *, int, short); /* Called when a watched file
+	                                                             descriptor is ready. */
+	void             (*cleanup)(struct sb_routine *); /* Called once when the routine stops. */
 	struct sb_routine *next;        /* Pointer to next routine in list. This is how we are
 	                                   going to keep track of the order of routines for
 	                                   printing to the status bar. */
@@ -88,14 +190,73 @@ typedef struct sb_routine {
 									   SB_FALSE means thread has exited and routine won't be run. */
 } sb_routine_t;
 
+/* File that a routine keeps open and reads over and over, like a sysfs attribute. */
+typedef struct sb_file {
+	int      fd;         /* Open file descriptor, or -1 if the file needs to be (re)opened. */
+	char     path[512];  /* Full path to the file. */
+#ifdef BUILD_IO_URING
+	char     data[4096]; /* Contents read ahead of the update by the batched sampler. */
+	ssize_t  len;        /* Length of data. */
+	SB_BOOL  ready;      /* SB_TRUE if data holds a sample that hasn't been read yet. */
+#endif
+} sb_file_t;
+
+/* Consistent copy of a routine's output, taken by the print loop. */
+typedef struct sb_output {
+	char           text[256];
+	size_t         length;
+	const char    *color;
+	unsigned long  generation;
+} sb_output_t;
+
+/* Fixed-size string that is built up by appending to the end. Keeping track of the length
+ * means appending never has to scan the string from the start. */
+typedef struct sb_buffer {
+	char   *data;     /* Start of the string. */
+	size_t  length;   /* Number of bytes used, not counting the terminator. */
+	size_t  capacity; /* Size of data, including room for the terminator. */
+} sb_buffer_t;
+
+/* One step of the compiled layout of the status bar. */
+enum sb_op_e {
+	SB_OP_ROUTINE = 0, /* Take a snapshot of routine. If it is empty, skip the next skip ops. */
+	SB_OP_LITERAL    , /* Copy length bytes of text. */
+	SB_OP_COLOR      , /* Copy the color of the last routine. */
+	SB_OP_TEXT       , /* Copy the output of the last routine. */
+};
+
+typedef struct sb_op {
+	enum sb_op_e  type;
+	const char   *text;    /* SB_OP_LITERAL: fixed text to copy. */
+	size_t        length;  /* SB_OP_LITERAL: length of text. */
+	sb_routine_t *routine; /* SB_OP_ROUTINE: routine whose output the following ops use. */
+	int           skip;    /* SB_OP_ROUTINE: number of ops that belong to the routine. */
+} sb_op_t;
+
+/* Timer object for the event loop. All routines with the same interval share one timer.
+ * When coalescing, routines whose intervals are multiples of the timer's interval share
+ * it too, and only run every few ticks. */
+typedef struct sb_timer {
+	enum sb_source_e  source;              /* Always SB_SOURCE_TIMER. */
+	int               fd;                  /* timerfd that expires every interval. */
+	long              interval;            /* Period of the timer, in microseconds. */
+	SB_BOOL           print;               /* SB_TRUE if the status bar is printed on every tick. */
+	uint64_t          ticks;               /* Number of times the timer has expired. */
+	int               count;               /* Number of routines attached to this timer. */
+	sb_routine_t     *routines[DELIMITER]; /* Routines to update when the timer expires. */
+	uint64_t          periods[DELIMITER];  /* Number of ticks between runs of each routine. */
+} sb_timer_t;
+
 static const char *routine_names[] = {
 	"Battery",
 	"CPU Temp",
 	"CPU Usage",
 	"Disk",
+	"Disk I/O",
 	"Fan",
 	"Load",
 	"Network",
+	"Pressure",
 	"RAM",
 	"Time",
 	"TODO",
@@ -113,5 +274,12 @@ sb_routine_t routine_array[DELIMITER + 1];
 /* This will be the ordered list of routines used for printing to the master string. */
 sb_routine_t *routine_list;
 
+/* Time (CLOCK_MONOTONIC) the program started. All routine and print deadlines are aligned to this. */
+struct timespec epoch;
+
+/* eventfd that routines signal when their output changes, so the print loop can print right
+ * away instead of waiting for the next tick. -1 if printing on change is turned off. */
+int notify_fd = -1;
+
 /* Mutex for keeping debug prints from clashing. */
 pthread_mutex_t debug_mutex;
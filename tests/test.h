@@ -0,0 +1,28 @@
+/* Each test program is built from the whole of statusbar.c so that it can reach the
+ * program's static functions directly. main is renamed out of the way for the test's own. */
+#define main statusbar_main
+#include "statusbar.c"
+#undef main
+
+/* Exit status that tells the test driver a test was skipped, for routines that weren't built. */
+#define SB_TEST_SKIP 77
+
+static int sb_test_failures = 0;
+
+#define SB_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			sb_test_failures++; \
+		} \
+	} while (0)
+
+#define SB_CHECK_STR(got, want) \
+	do { \
+		if (strcmp((got), (want)) != 0) { \
+			fprintf(stderr, "%s:%d: got \"%s\", want \"%s\"\n", __FILE__, __LINE__, (got), (want)); \
+			sb_test_failures++; \
+		} \
+	} while (0)
+
+#define SB_TEST_RESULT (sb_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
@@ -0,0 +1,66 @@
+#include "test.h"
+
+#ifdef BUILD_CPU_USAGE
+static SB_BOOL sb_test_parse(const char *stat)
+{
+	/* The parser works in place on the routine's buffer, so give it a copy it can keep. */
+	static char buf[1024];
+
+	snprintf(buf, sizeof(buf), "%s", stat);
+	sb_cpu_usage.buf = buf;
+	return sb_cpu_usage_parse();
+}
+
+int main(void)
+{
+	unsigned long busy[4];
+	unsigned long total[4];
+
+	memset(&sb_cpu_usage, 0, sizeof(sb_cpu_usage));
+	sb_cpu_usage.num_cpus = 3;
+	sb_cpu_usage.busy     = busy;
+	sb_cpu_usage.total    = total;
+	memset(busy, 0, sizeof(busy));
+	memset(total, 0, sizeof(total));
+
+	/* core 1 is offline, core 2 is from an older kernel with only four fields, and core 7
+	 * is more than we have room for. */
+	busy[2]  = 777;
+	total[2] = 777;
+	SB_CHECK(sb_test_parse(
+		"cpu  10 20 30 400 5 6 7 8 9 10\n"
+		"cpu0 1 2 3 40 1 1 1 1 0 0\n"
+		"cpu2 4 0 6 90\n"
+		"cpu7 1 1 1 1 1 1 1 1 1 1\n"
+		"intr 12345 0 0\n"
+		"ctxt 678\n"));
+
+	/* iowait counts as idle, guest time isn't counted twice. */
+	SB_CHECK(busy[0] == 81);
+	SB_CHECK(total[0] == 486);
+	SB_CHECK(sb_cpu_usage.fields[SB_CPU_FIELD_STEAL] == 8);
+	SB_CHECK(sb_cpu_usage.fields[SB_CPU_FIELD_GUEST_NICE] == 10);
+	SB_CHECK(busy[1] == 9);
+	SB_CHECK(total[1] == 50);
+	SB_CHECK(busy[2] == 777);
+	SB_CHECK(total[2] == 777);
+	SB_CHECK(busy[3] == 10);
+	SB_CHECK(total[3] == 100);
+
+	/* A buffer that ends within or right after the CPU lines was too small. */
+	SB_CHECK(!sb_test_parse("cpu  1 2 3 4 5 6 7 8 9 10\n"));
+	SB_CHECK(!sb_test_parse("cpu  1 2 3 4 5 6 7 8 9 10\ncpu0 1 2"));
+
+	/* No CPU lines at all leaves everything alone. */
+	busy[0] = 10;
+	SB_CHECK(sb_test_parse("intr 1\n"));
+	SB_CHECK(busy[0] == 10);
+
+	return SB_TEST_RESULT;
+}
+#else
+int main(void)
+{
+	return SB_TEST_SKIP;
+}
+#endif
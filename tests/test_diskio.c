@@ -0,0 +1,110 @@
+/* The mounts are read from a fixture instead of this process's own mountinfo. */
+static char sb_test_mountinfo[] = "/tmp/statusbar-mountinfo-XXXXXX";
+#define SB_DISKIO_MOUNTINFO sb_test_mountinfo
+
+#include "test.h"
+
+#ifdef BUILD_DISKIO
+static void sb_test_find_device(void)
+{
+	unsigned int maj = 0;
+	unsigned int min = 0;
+	int          fd;
+	FILE        *file;
+
+	fd = mkstemp(sb_test_mountinfo);
+	if (fd < 0 || (file = fdopen(fd, "w")) == NULL) {
+		fprintf(stderr, "failed to write mountinfo fixture\n");
+		sb_test_failures++;
+		return;
+	}
+	fputs("22 1 8:2 / / rw,relatime shared:1 - ext4 /dev/sda2 rw,errors=remount-ro\n"
+	      "30 22 0:25 / /home rw,nosuid,nodev - tmpfs tmpfs rw\n"
+	      "31 22 8:17 / /home rw,relatime shared:7 - ext4 /dev/sdb1 rw\n"
+	      "32 22 8:33 / /homes rw,relatime shared:8 - ext4 /dev/sdc1 rw\n"
+	      "33 22 0:26 / /run rw,nosuid,nodev - tmpfs tmpfs rw\n"
+	      "34 22 8:49 / /mnt/My\\040Disk rw,relatime shared:9 - ext4 /dev/sdd1 rw\n"
+	      "35 22 8:65 / /mnt/tab\\011back\\134slash rw,relatime shared:10 - ext4 /dev/sde1 rw\n", file);
+	fclose(file);
+
+	SB_CHECK(sb_diskio_find_device("/", &maj, &min));
+	SB_CHECK(maj == 8 && min == 2);
+
+	/* The last mount on a path hides the ones before it. */
+	SB_CHECK(sb_diskio_find_device("/home", &maj, &min));
+	SB_CHECK(maj == 8 && min == 17);
+
+	/* Mount points are written with octal escapes for spaces, tabs, and backslashes. */
+	SB_CHECK(sb_diskio_find_device("/mnt/My Disk", &maj, &min));
+	SB_CHECK(maj == 8 && min == 49);
+	SB_CHECK(sb_diskio_find_device("/mnt/tab\tback\\slash", &maj, &min));
+	SB_CHECK(maj == 8 && min == 65);
+	SB_CHECK(!sb_diskio_find_device("/mnt/My\\040Disk", &maj, &min));
+
+	/* No block device behind it, or not mounted at all. */
+	SB_CHECK(!sb_diskio_find_device("/run", &maj, &min));
+	SB_CHECK(!sb_diskio_find_device("/ho", &maj, &min));
+
+	unlink(sb_test_mountinfo);
+	SB_CHECK(!sb_diskio_find_device("/", &maj, &min));
+}
+
+static SB_BOOL sb_test_parse(char buf[], size_t size, const char *diskstats)
+{
+	snprintf(buf, size, "%s", diskstats);
+	sb_diskio.buf  = buf;
+	sb_diskio.size = size;
+	return sb_diskio_parse();
+}
+
+static void sb_test_parse_stats(void)
+{
+	char                    buf[1024];
+	struct sb_diskio_stats *stats;
+
+	memset(&sb_diskio, 0, sizeof(sb_diskio));
+	sb_diskio.devices[0].major = 8;
+	sb_diskio.devices[0].minor = 2;
+	sb_diskio.devices[1].major = 8;
+	sb_diskio.devices[1].minor = 17;
+
+	SB_CHECK(sb_test_parse(buf, sizeof(buf),
+		"   7       0 loop0 10 0 20 1 0 0 0 0 0 4 1 0 0 0 0\n"
+		"   8       0 sda 900 9 9000 90 900 9 9000 90 0 900 900\n"
+		"   8       2 sda2 100 5 2000 30 200 6 4000 60 0 90 120 0 0 0 0 0 0\n"
+		"  80       2 xda2 1 1 1 1 1 1 1 1 1 1 1\n"
+		"   8      17 sdb1 1 2 3 4 5 6 7 8 9 10 11\n"));
+	SB_CHECK(sb_diskio.devices[0].found);
+	stats = &sb_diskio.devices[0].new_stats;
+	SB_CHECK(stats->reads == 100 && stats->read_secs == 2000 && stats->read_ms == 30);
+	SB_CHECK(stats->writes == 200 && stats->write_secs == 4000 && stats->write_ms == 60);
+	SB_CHECK(stats->io_ms == 90);
+	SB_CHECK(sb_diskio.devices[1].found);
+	stats = &sb_diskio.devices[1].new_stats;
+	SB_CHECK(stats->reads == 1 && stats->read_secs == 3 && stats->read_ms == 4);
+	SB_CHECK(stats->writes == 5 && stats->write_secs == 7 && stats->write_ms == 8);
+	SB_CHECK(stats->io_ms == 10);
+
+	/* A device that went away is no longer found, and the last line needs no newline. */
+	SB_CHECK(sb_test_parse(buf, sizeof(buf), "   8       2 sda2 101 5 2001 30 200 6 4000 60 0 91 120"));
+	SB_CHECK(sb_diskio.devices[0].found);
+	SB_CHECK(sb_diskio.devices[0].new_stats.io_ms == 91);
+	SB_CHECK(!sb_diskio.devices[1].found);
+
+	/* A file that fills the buffer may have been cut off. */
+	SB_CHECK(!sb_test_parse(buf, 16, "   8       2 sda2 101 5 2001 30 200 6 4000 60 0 91 120\n"));
+}
+
+int main(void)
+{
+	sb_test_find_device();
+	sb_test_parse_stats();
+
+	return SB_TEST_RESULT;
+}
+#else
+int main(void)
+{
+	return SB_TEST_SKIP;
+}
+#endif
@@ -0,0 +1,140 @@
+#include "test.h"
+
+#ifdef BUILD_WEATHER
+/* Trimmed down from a real forecast, with a few things added to trip up the scanner. */
+static const char sb_test_document[] =
+	"{\n"
+	"  \"@context\": [\"https://geojson.org/geojson-ld/geojson-context.jsonld\",\n"
+	"                {\"@version\": \"1.1\", \"wx\": \"https://api.weather.gov/ontology#\"}],\n"
+	"  \"type\": \"Feature\",\n"
+	"  \"properties\": {\n"
+	"    \"updated\": \"2026-10-17T10:00:00+00:00\",\n"
+	"    \"elevation\": {\"unitCode\": \"wmoUnit:m\", \"value\": 1.5e2},\n"
+	"    \"note\": \"say \\\"hi\\\"\\n\\u00b0 done\",\n"
+	"    \"periods\": [\n"
+	"      {\"number\": 1, \"name\": \"Tonight\", \"temperature\": 48, \"isDaytime\": false,\n"
+	"       \"detailedForecast\": \"Mostly cloudy, with a low around 48. Southwest wind around 5 mph.\"},\n"
+	"      {\"number\": 2, \"name\": \"Saturday\", \"temperature\":-3,\n"
+	"       \"nested\": [[1, 2], [3, {\"deep\": true}]], \"empty\": [], \"none\": {}},\n"
+	"      {\"number\": 3, \"name\": \"Saturday Night\", \"temperature\": 7.6e1}\n"
+	"    ]\n"
+	"  }\n"
+	"}\n";
+
+static struct sb_json_query sb_test_queries[] = {
+	{ "properties.periods[0].name" },
+	{ "properties.periods[1].temperature" },
+	{ "properties.periods[2].temperature" },
+	{ "properties.periods[2].name" },
+	{ "properties.note" },
+	{ "properties.elevation.value" },
+	{ "properties.periods[1].nested[1][1].deep" },
+	{ "@context[1].@version" },
+	{ "properties.periods[0].detailedForecast" },
+	{ "properties.periods[3].temperature" },
+};
+
+#define SB_TEST_QUERIES (int)(sizeof(sb_test_queries) / sizeof(*sb_test_queries))
+
+static void sb_test_feed(size_t chunk)
+{
+	/* The document must come out the same no matter how it is split up. */
+	sb_json_t json;
+	size_t    len = strlen(sb_test_document);
+	size_t    i;
+	int       value;
+
+	sb_json_init(&json, sb_test_queries, SB_TEST_QUERIES);
+	for (i=0; i<len; i+=chunk)
+		sb_json_feed(&json, sb_test_document + i, len - i < chunk ? len - i : chunk);
+
+	SB_CHECK(!json.error);
+	SB_CHECK(json.num_found == SB_TEST_QUERIES - 1);
+	SB_CHECK_STR(sb_test_queries[0].value, "Tonight");
+	SB_CHECK(sb_json_int(&sb_test_queries[1], &value) && value == -3);
+	SB_CHECK(sb_json_int(&sb_test_queries[2], &value) && value == 76);
+	SB_CHECK_STR(sb_test_queries[3].value, "Saturday Night");
+	SB_CHECK_STR(sb_test_queries[4].value, "say \"hi\"\n? done");
+	SB_CHECK(sb_json_int(&sb_test_queries[5], &value) && value == 150);
+	SB_CHECK_STR(sb_test_queries[6].value, "true");
+	SB_CHECK_STR(sb_test_queries[7].value, "1.1");
+
+	/* Values too long to keep are cut short. */
+	SB_CHECK(strlen(sb_test_queries[8].value) == sizeof(sb_test_queries[8].value) - 1);
+	SB_CHECK(strncmp(sb_test_queries[8].value, "Mostly cloudy", 13) == 0);
+
+	SB_CHECK(!sb_test_queries[9].found);
+	SB_CHECK(!sb_json_int(&sb_test_queries[9], &value));
+}
+
+static void sb_test_errors(void)
+{
+	struct sb_json_query query = { "a" };
+	sb_json_t            json;
+	char                 deep[SB_JSON_DEPTH + 2];
+
+	/* A stray closing bracket. */
+	sb_json_init(&json, &query, 1);
+	sb_json_feed(&json, "]{\"a\": 1}", 9);
+	SB_CHECK(json.error);
+	SB_CHECK(!query.found);
+
+	/* Nesting deeper than we keep track of. */
+	memset(deep, '[', sizeof(deep));
+	sb_json_init(&json, &query, 1);
+	sb_json_feed(&json, deep, sizeof(deep));
+	SB_CHECK(json.error);
+
+	/* Once everything is found, whatever comes after isn't looked at. */
+	sb_json_init(&json, &query, 1);
+	sb_json_feed(&json, "{\"a\": 1, ]]]", 12);
+	SB_CHECK(!json.error);
+	SB_CHECK_STR(query.value, "1");
+}
+
+static void sb_test_int(void)
+{
+	struct sb_json_query query = { "a", "", SB_TRUE };
+	static const struct {
+		const char *text;
+		SB_BOOL     valid;
+		int         value;
+	} cases[] = {
+		{ "48"   , SB_TRUE , 48     },
+		{ "-3"   , SB_TRUE , -3     },
+		{ "2.5"  , SB_TRUE , 3      },
+		{ "-2.5" , SB_TRUE , -3     },
+		{ "1e3"  , SB_TRUE , 1000   },
+		{ "1e7"  , SB_FALSE, 0      },
+		{ "12abc", SB_FALSE, 0      },
+		{ "true" , SB_FALSE, 0      },
+		{ "nan"  , SB_FALSE, 0      },
+		{ ""     , SB_FALSE, 0      },
+	};
+	size_t i;
+	int    value;
+
+	for (i=0; i<sizeof(cases) / sizeof(*cases); i++) {
+		snprintf(query.value, sizeof(query.value), "%s", cases[i].text);
+		value = 0;
+		SB_CHECK(sb_json_int(&query, &value) == cases[i].valid);
+		SB_CHECK(value == cases[i].value);
+	}
+}
+
+int main(void)
+{
+	sb_test_feed(1);
+	sb_test_feed(7);
+	sb_test_feed(sizeof(sb_test_document));
+	sb_test_errors();
+	sb_test_int();
+
+	return SB_TEST_RESULT;
+}
+#else
+int main(void)
+{
+	return SB_TEST_SKIP;
+}
+#endif
@@ -0,0 +1,70 @@
+#include "test.h"
+
+#ifdef BUILD_RAM
+static SB_BOOL sb_test_parse(const char *meminfo)
+{
+	snprintf(sb_ram.buf, sizeof(sb_ram.buf), "%s", meminfo);
+	return sb_ram_parse();
+}
+
+int main(void)
+{
+	unsigned long *values = sb_ram.values;
+
+	SB_CHECK(sb_test_parse(
+		"MemTotal:       16314420 kB\n"
+		"MemFree:         1184740 kB\n"
+		"MemAvailable:    9712336 kB\n"
+		"Buffers:          612052 kB\n"
+		"Cached:          7688216 kB\n"
+		"SwapCached:         1024 kB\n"
+		"Active:          8218716 kB\n"
+		"SwapTotal:       2097148 kB\n"
+		"SwapFree:        2096124 kB\n"
+		"Dirty:               772 kB\n"
+		"Writeback:             4 kB\n"
+		"HugePages_Total:       8\n"
+		"HugePages_Free:        3\n"
+		"Hugepagesize:       2048 kB\n"));
+	SB_CHECK(values[SB_RAM_KEY_MEM_TOTAL] == 16314420);
+	SB_CHECK(values[SB_RAM_KEY_MEM_FREE] == 1184740);
+	SB_CHECK(values[SB_RAM_KEY_MEM_AVAILABLE] == 9712336);
+	SB_CHECK(values[SB_RAM_KEY_BUFFERS] == 612052);
+	SB_CHECK(values[SB_RAM_KEY_CACHED] == 7688216);
+	SB_CHECK(values[SB_RAM_KEY_SWAP_TOTAL] == 2097148);
+	SB_CHECK(values[SB_RAM_KEY_SWAP_FREE] == 2096124);
+	SB_CHECK(values[SB_RAM_KEY_DIRTY] == 772);
+	SB_CHECK(values[SB_RAM_KEY_WRITEBACK] == 4);
+	SB_CHECK(values[SB_RAM_KEY_HUGEPAGES_TOTAL] == 8);
+	SB_CHECK(values[SB_RAM_KEY_HUGEPAGES_FREE] == 3);
+
+	/* Kernels before 3.14 have no MemAvailable, and SwapCached must not be taken for Cached.
+	 * Nothing from the last parse may be left behind. */
+	SB_CHECK(sb_test_parse(
+		"MemTotal:        1024000 kB\n"
+		"MemFree:          100000 kB\n"
+		"Buffers:           20000 kB\n"
+		"SwapCached:         1024 kB\n"
+		"Cached:           300000 kB\n"));
+	SB_CHECK(values[SB_RAM_KEY_MEM_TOTAL] == 1024000);
+	SB_CHECK(values[SB_RAM_KEY_MEM_AVAILABLE] == 0);
+	SB_CHECK(values[SB_RAM_KEY_CACHED] == 300000);
+	SB_CHECK(values[SB_RAM_KEY_SWAP_TOTAL] == 0);
+	SB_CHECK(values[SB_RAM_KEY_HUGEPAGES_TOTAL] == 0);
+
+	/* Without MemTotal, there is nothing to show. */
+	SB_CHECK(!sb_test_parse("MemFree:          100000 kB\n"));
+	SB_CHECK(!sb_test_parse(""));
+
+	/* The last line doesn't need a newline. */
+	SB_CHECK(sb_test_parse("MemFree:          100000 kB\nMemTotal:        1024000 kB"));
+	SB_CHECK(values[SB_RAM_KEY_MEM_TOTAL] == 1024000);
+
+	return SB_TEST_RESULT;
+}
+#else
+int main(void)
+{
+	return SB_TEST_SKIP;
+}
+#endif
@@ -0,0 +1,123 @@
+#include "test.h"
+
+static sb_routine_t sb_test_routines[2];
+static int          sb_test_calls[2];
+
+static SB_BOOL sb_test_update(sb_routine_t *routine)
+{
+	sb_test_calls[routine - sb_test_routines]++;
+	return SB_TRUE;
+}
+
+static void sb_test_skip_missed(void)
+{
+	struct timespec deadline;
+	struct timespec now;
+
+	/* Not late: nothing moves. */
+	deadline = (struct timespec){ .tv_sec = 10, .tv_nsec = 0 };
+	now      = (struct timespec){ .tv_sec = 9,  .tv_nsec = 500000000 };
+	SB_CHECK(sb_skip_missed(&deadline, &now, 1000000) == 0);
+	SB_CHECK(deadline.tv_sec == 10 && deadline.tv_nsec == 0);
+
+	/* Half an interval late: the next deadline on the grid is one interval later. */
+	now = (struct timespec){ .tv_sec = 10, .tv_nsec = 500000000 };
+	SB_CHECK(sb_skip_missed(&deadline, &now, 1000000) == 500000);
+	SB_CHECK(deadline.tv_sec == 11 && deadline.tv_nsec == 0);
+
+	/* Exactly two intervals late: the deadline that is due right now is skipped too. */
+	deadline = (struct timespec){ .tv_sec = 10, .tv_nsec = 0 };
+	now      = (struct timespec){ .tv_sec = 12, .tv_nsec = 0 };
+	SB_CHECK(sb_skip_missed(&deadline, &now, 1000000) == 2000000);
+	SB_CHECK(deadline.tv_sec == 13 && deadline.tv_nsec == 0);
+
+	/* Moving the deadline carries nanoseconds into seconds. */
+	deadline = (struct timespec){ .tv_sec = 10, .tv_nsec = 800000000 };
+	now      = (struct timespec){ .tv_sec = 11, .tv_nsec = 0 };
+	SB_CHECK(sb_skip_missed(&deadline, &now, 300000) == 200000);
+	SB_CHECK(deadline.tv_sec == 11 && deadline.tv_nsec == 100000000);
+}
+
+static void sb_test_timespec_add(void)
+{
+	struct timespec tp;
+
+	tp = (struct timespec){ .tv_sec = 10, .tv_nsec = 900000000 };
+	sb_timespec_add(&tp, 200000);
+	SB_CHECK(tp.tv_sec == 11 && tp.tv_nsec == 100000000);
+
+	/* Moving back borrows from the seconds instead of leaving nanoseconds negative. */
+	tp = (struct timespec){ .tv_sec = 10, .tv_nsec = 100000000 };
+	sb_timespec_add(&tp, -200000);
+	SB_CHECK(tp.tv_sec == 9 && tp.tv_nsec == 900000000);
+
+	tp = (struct timespec){ .tv_sec = 10, .tv_nsec = 0 };
+	sb_timespec_add(&tp, -2500000);
+	SB_CHECK(tp.tv_sec == 7 && tp.tv_nsec == 500000000);
+
+	tp = (struct timespec){ .tv_sec = 10, .tv_nsec = 500000000 };
+	sb_timespec_add(&tp, -500000);
+	SB_CHECK(tp.tv_sec == 10 && tp.tv_nsec == 0);
+
+	/* A deadline that is already behind us is still one the kernel accepts, and sleeping
+	 * until it returns right away. */
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	sb_timespec_add(&tp, -1300000);
+	SB_CHECK(tp.tv_nsec >= 0 && tp.tv_nsec < 1000000000);
+	SB_CHECK(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == 0);
+}
+
+static void sb_test_count_runs(void)
+{
+	SB_CHECK(sb_timer_count_runs(0, 1) == 0);
+	SB_CHECK(sb_timer_count_runs(0, 3) == 0);
+	SB_CHECK(sb_timer_count_runs(1, 3) == 1);
+	SB_CHECK(sb_timer_count_runs(3, 3) == 1);
+	SB_CHECK(sb_timer_count_runs(4, 3) == 2);
+	SB_CHECK(sb_timer_count_runs(7, 3) == 3);
+	SB_CHECK(sb_timer_count_runs(5, 1) == 5);
+}
+
+static void sb_test_timer_run(enum sb_overrun_e policy, int want_fast, int want_slow)
+{
+	/* One routine runs on every tick and one on every third tick. The timer is four ticks
+	 * behind, and then one more tick comes on time. */
+	sb_timer_t timer;
+	int        i;
+
+	memset(sb_test_routines, 0, sizeof(sb_test_routines));
+	memset(&timer, 0, sizeof(timer));
+	for (i=0; i<2; i++) {
+		sb_test_routines[i].name   = "test";
+		sb_test_routines[i].run    = SB_TRUE;
+		sb_test_routines[i].update = sb_test_update;
+		timer.routines[i]          = &sb_test_routines[i];
+	}
+	timer.periods[0] = 1;
+	timer.periods[1] = 3;
+	timer.count      = 2;
+
+	overrun = policy;
+	memset(sb_test_calls, 0, sizeof(sb_test_calls));
+	sb_timer_run(&timer, 4);
+	SB_CHECK(sb_test_calls[0] == want_fast);
+	SB_CHECK(sb_test_calls[1] == want_slow);
+	SB_CHECK(timer.ticks == 4);
+
+	memset(sb_test_calls, 0, sizeof(sb_test_calls));
+	sb_timer_run(&timer, 1);
+	SB_CHECK(sb_test_calls[0] == 1);
+	SB_CHECK(sb_test_calls[1] == 0);
+	SB_CHECK(timer.ticks == 5);
+}
+
+int main(void)
+{
+	sb_test_timespec_add();
+	sb_test_skip_missed();
+	sb_test_count_runs();
+	sb_test_timer_run(SB_OVERRUN_SKIP,    1, 1);
+	sb_test_timer_run(SB_OVERRUN_CATCHUP, 4, 2);
+
+	return SB_TEST_RESULT;
+}
@@ -0,0 +1,94 @@
+#include "test.h"
+
+#define SB_TEST_WRITES 200000
+
+static sb_routine_t sb_test_routine;
+static const char   sb_test_long_color[]  = "#111111";
+static const char   sb_test_short_color[] = "#222222";
+static atomic_int   sb_test_done;
+
+static void *sb_test_writer(void *arg)
+{
+	/* Switch between a long output and a short one with different colors, so that a torn
+	 * read would mix up lengths, text, or colors. */
+	char long_output[201];
+	int  i;
+
+	(void)arg;
+	memset(long_output, 'a', sizeof(long_output) - 1);
+	long_output[sizeof(long_output) - 1] = '\0';
+
+	for (i=0; i<SB_TEST_WRITES; i++) {
+		if (i % 2 == 0)
+			sb_publish(&sb_test_routine, sb_test_long_color, "%s", long_output);
+		else
+			sb_publish(&sb_test_routine, sb_test_short_color, "bb");
+	}
+
+	atomic_store(&sb_test_done, 1);
+	return NULL;
+}
+
+static SB_BOOL sb_test_consistent(const sb_output_t *snapshot)
+{
+	size_t i;
+
+	if (snapshot->generation == 0)
+		return snapshot->length == 0 && snapshot->color == NULL;
+
+	if (snapshot->color == sb_test_short_color)
+		return snapshot->length == 2 && strcmp(snapshot->text, "bb") == 0;
+
+	if (snapshot->color != sb_test_long_color || snapshot->length != 200)
+		return SB_FALSE;
+	for (i=0; i<snapshot->length; i++)
+		if (snapshot->text[i] != 'a')
+			return SB_FALSE;
+	return snapshot->text[snapshot->length] == '\0';
+}
+
+int main(void)
+{
+	pthread_t     writer;
+	sb_output_t   snapshot;
+	unsigned long last = 0;
+	long          reads = 0;
+	long          torn  = 0;
+	long          back  = 0;
+
+	memset(&sb_test_routine, 0, sizeof(sb_test_routine));
+	sb_test_routine.name = "test";
+
+	if (pthread_create(&writer, NULL, sb_test_writer, NULL) != 0) {
+		fprintf(stderr, "failed to start writer\n");
+		return EXIT_FAILURE;
+	}
+
+	while (!atomic_load(&sb_test_done)) {
+		sb_read_output(&sb_test_routine, &snapshot);
+		if (!sb_test_consistent(&snapshot))
+			torn++;
+		if (snapshot.generation < last)
+			back++;
+		last = snapshot.generation;
+		reads++;
+	}
+	pthread_join(writer, NULL);
+
+	SB_CHECK(torn == 0);
+	SB_CHECK(back == 0);
+	SB_CHECK(reads > 0);
+
+	/* Every write changed the output and left the lock released, and writing the same
+	 * output again changes nothing. */
+	sb_read_output(&sb_test_routine, &snapshot);
+	SB_CHECK(snapshot.generation == SB_TEST_WRITES);
+	SB_CHECK(atomic_load(&(sb_test_routine.seq)) == 2 * SB_TEST_WRITES);
+	SB_CHECK_STR(snapshot.text, "bb");
+	sb_publish(&sb_test_routine, sb_test_short_color, "bb");
+	sb_read_output(&sb_test_routine, &snapshot);
+	SB_CHECK(snapshot.generation == SB_TEST_WRITES);
+	SB_CHECK(atomic_load(&(sb_test_routine.seq)) == 2 * SB_TEST_WRITES);
+
+	return SB_TEST_RESULT;
+}
@@ -0,0 +1,62 @@
+#include "test.h"
+
+static sb_routine_t sb_test_routines[4];
+
+static void sb_test_setup(void)
+{
+	/* Two routines with output around an empty one, then a delimiter and a third routine. */
+	static const char *names[] = { "one", "empty", NULL, "three" };
+	int                i;
+
+	memset(sb_test_routines, 0, sizeof(sb_test_routines));
+	for (i=0; i<4; i++) {
+		sb_test_routines[i].routine = names[i] != NULL ? BATTERY : DELIMITER;
+		sb_test_routines[i].name    = names[i] != NULL ? names[i] : "delimiter";
+		sb_test_routines[i].next    = i < 3 ? &sb_test_routines[i+1] : NULL;
+	}
+	routine_list = &sb_test_routines[0];
+
+	sb_publish(&sb_test_routines[0], "#aaaaaa", "one");
+	sb_publish(&sb_test_routines[3], "#cccccc", "three");
+}
+
+static void sb_test_render(size_t capacity, const char *want)
+{
+	char        data[SBLENGTH];
+	sb_buffer_t buffer;
+
+	sb_buffer_init(&buffer, data, capacity);
+	sb_template_render(&buffer);
+	SB_CHECK_STR(buffer.data, want);
+	SB_CHECK(buffer.length == strlen(want));
+}
+
+int main(void)
+{
+	sb_test_setup();
+
+	color_text = SB_FALSE;
+	sb_template_compile();
+	SB_CHECK(sb_template.count == 13);
+	sb_test_render(SBLENGTH, "[one] ;[three] ");
+
+	/* A routine that doesn't fit is dropped whole, along with everything after it. */
+	sb_test_render(12, "[one] ;");
+	sb_test_render(6,  "");
+
+	color_text = SB_TRUE;
+	sb_template_compile();
+	SB_CHECK(sb_template.count == 19);
+	sb_test_render(SBLENGTH, "[^c#aaaaaa^one^d^] ;[^c#cccccc^three^d^] ");
+
+	/* Rendering marks what was printed, so the print loop can tell nothing changed since. */
+	SB_CHECK(sb_test_routines[0].printed == 1);
+	SB_CHECK(sb_test_routines[1].printed == 0);
+	SB_CHECK(sb_test_routines[3].printed == 1);
+
+	/* New output shows up without compiling again. */
+	sb_publish(&sb_test_routines[1], "#bbbbbb", "two");
+	sb_test_render(SBLENGTH, "[^c#aaaaaa^one^d^] [^c#bbbbbb^two^d^] ;[^c#cccccc^three^d^] ");
+
+	return SB_TEST_RESULT;
+}